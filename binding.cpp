@@ -1,12 +1,150 @@
+#include "cdbclient.h"
 #include "cdbdirect.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <mutex>
 #include <optional>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <thread>
 
 namespace py = pybind11;
 
+// A scan of the DB in key order, which a thread of its own runs ahead of the
+// Python consumer (without the GIL), decoding the entries into columnar batches
+// that are converted to numpy arrays when requested
+class Scan {
+public:
+  Scan(std::uintptr_t handle, size_t threads, const std::string &start,
+       const std::string &stop, size_t batch_size)
+      : m_batch_size(std::max<size_t>(batch_size, 1)) {
+    m_producer = std::thread([this, handle, threads, start, stop]() {
+      Batch batch;
+      auto push = [&]() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space.wait(lock,
+                     [&] { return m_stop || m_batches.size() < m_prefetch; });
+        if (m_stop)
+          return false;
+        m_batches.push_back(std::move(batch));
+        batch = Batch();
+        m_ready.notify_one();
+        return true;
+      };
+
+      cdbdirect_apply_ordered(
+          handle, threads,
+          [&](const std::string &fen,
+              const std::vector<std::pair<std::string, int>> &scored) {
+            batch.add(fen, scored);
+            return batch.size() < m_batch_size || push();
+          },
+          start, stop);
+      if (batch.size())
+        push();
+
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      m_finished = true;
+      m_ready.notify_one();
+    });
+  }
+
+  ~Scan() { close(); }
+
+  void close() {
+    if (!m_producer.joinable())
+      return;
+    {
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+      m_space.notify_one();
+    }
+    py::gil_scoped_release release;
+    m_producer.join();
+  }
+
+  py::dict next() {
+    Batch batch;
+    {
+      py::gil_scoped_release release;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_ready.wait(lock, [&] { return !m_batches.empty() || m_finished; });
+      if (!m_batches.empty()) {
+        batch = std::move(m_batches.front());
+        m_batches.pop_front();
+        m_space.notify_one();
+      }
+    }
+    if (!batch.size())
+      throw py::stop_iteration();
+    return batch.to_numpy();
+  }
+
+private:
+  // the entries of a batch in columns: fen and min_ply per entry, and the
+  // scored moves of all entries, where those of entry i are at offsets[i] up
+  // to offsets[i + 1]
+  struct Batch {
+    std::vector<std::string> fens;
+    std::vector<std::int32_t> min_ply;
+    std::vector<std::int64_t> offsets = {0};
+    std::vector<char> moves;
+    std::vector<std::int32_t> scores;
+
+    size_t size() const { return fens.size(); }
+
+    void add(const std::string &fen,
+             const std::vector<std::pair<std::string, int>> &scored) {
+      fens.push_back(fen);
+      // the last entry is a0a0 with the min_ply
+      min_ply.push_back(scored.back().second);
+      for (size_t i = 0; i + 1 < scored.size(); i++) {
+        char move[5] = {};
+        std::memcpy(move, scored[i].first.data(),
+                    std::min<size_t>(scored[i].first.size(), sizeof(move)));
+        moves.insert(moves.end(), move, move + sizeof(move));
+        scores.push_back(scored[i].second);
+      }
+      offsets.push_back(scores.size());
+    }
+
+    py::dict to_numpy() const {
+      size_t width = 1;
+      for (auto &fen : fens)
+        width = std::max(width, fen.size());
+      py::array fen_array(py::dtype("S" + std::to_string(width)),
+                          {fens.size()});
+      char *data = static_cast<char *>(fen_array.mutable_data());
+      std::memset(data, 0, fens.size() * width);
+      for (size_t i = 0; i < fens.size(); i++)
+        std::memcpy(data + i * width, fens[i].data(), fens[i].size());
+
+      py::array move_array(py::dtype("S5"), {scores.size()});
+      std::memcpy(move_array.mutable_data(), moves.data(), moves.size());
+
+      py::dict batch;
+      batch["fen"] = fen_array;
+      batch["min_ply"] = py::array_t<std::int32_t>(min_ply.size(),
+                                                   min_ply.data());
+      batch["offsets"] = py::array_t<std::int64_t>(offsets.size(),
+                                                   offsets.data());
+      batch["move"] = move_array;
+      batch["score"] = py::array_t<std::int32_t>(scores.size(), scores.data());
+      return batch;
+    }
+  };
+
+  const size_t m_batch_size, m_prefetch = 4;
+  std::mutex m_mutex;
+  std::condition_variable m_ready, m_space;
+  std::deque<Batch> m_batches;
+  bool m_stop = false, m_finished = false;
+  std::thread m_producer;
+};
+
 class CDB {
 public:
   CDB(const std::string &path, std::optional<size_t> threads) {
@@ -54,16 +192,80 @@ public:
     cdbdirect_apply(m_handle, m_threads, cpp_callback);
   }
 
+  Scan *iter(std::optional<std::string> start, std::optional<std::string> stop,
+             size_t batch_size) {
+    return new Scan(m_handle, m_threads, start.value_or(""),
+                    stop.value_or(""), batch_size);
+  }
+
+private:
+  std::uintptr_t m_handle;
+  size_t m_threads;
+};
+
+// the same interface, served by a running cdbdirect_server
+class Client {
+public:
+  Client(const std::string &address, std::optional<size_t> threads) {
+    m_threads = threads.value_or(
+        std::max((unsigned int)1, std::thread::hardware_concurrency()));
+    m_handle = cdbclient_connect(address);
+    if (!m_handle)
+      throw std::runtime_error("Connect failed: " + address);
+  }
+
+  ~Client() {
+    if (m_handle)
+      cdbclient_close(m_handle);
+  }
+
+  uint64_t size() const { return cdbclient_size(m_handle); }
+  auto get(const std::string &fen) { return cdbclient_get(m_handle, fen); }
+  auto get_many(const std::vector<std::string> &fens) {
+    return cdbclient_get(m_handle, fens);
+  }
+
+  void apply(py::function callback) {
+    // the callback is only called from this thread
+    cdbclient_apply(
+        m_handle, m_threads,
+        [&](const std::string &fen,
+            const std::vector<std::pair<std::string, int>> &entries) -> bool {
+          try {
+            return callback(fen, py::cast(entries)).cast<bool>();
+          } catch (py::error_already_set &e) {
+            return false;
+          }
+        });
+  }
+
 private:
   std::uintptr_t m_handle;
   size_t m_threads;
 };
 
 PYBIND11_MODULE(cdbdirect, m) {
+  // failures of the server connection, a RuntimeError
+  py::register_exception<CDBClientError>(m, "ClientError", PyExc_RuntimeError);
+  py::class_<Scan>(m, "Scan")
+      .def("__iter__", [](Scan &scan) -> Scan & { return scan; },
+           py::return_value_policy::reference)
+      .def("__next__", &Scan::next)
+      .def("close", &Scan::close);
   py::class_<CDB>(m, "CDB")
       .def(py::init<const std::string &, std::optional<size_t>>(),
            py::arg("path"), py::arg("threads") = py::none())
       .def("size", &CDB::size)
       .def("get", &CDB::get)
-      .def("apply", &CDB::apply);
+      .def("apply", &CDB::apply)
+      .def("iter", &CDB::iter, py::arg("start") = py::none(),
+           py::arg("stop") = py::none(), py::arg("batch_size") = 65536,
+           py::keep_alive<0, 1>());
+  py::class_<Client>(m, "Client")
+      .def(py::init<const std::string &, std::optional<size_t>>(),
+           py::arg("address") = "", py::arg("threads") = py::none())
+      .def("size", &Client::size)
+      .def("get", &Client::get)
+      .def("get_many", &Client::get_many)
+      .def("apply", &Client::apply);
 }
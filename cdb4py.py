@@ -40,4 +40,16 @@ end_time = time.time()
 print(
     f"Batch process completed in {end_time - start_time:.2f} seconds. Speed {limit / (end_time - start_time):.2f} entries/sec."
 )
+
+# 4. The same as a generator of batches, decoded ahead in the background
+count = 0
+start_time = time.time()
+for batch in db.iter(batch_size=10000):
+    count += len(batch["fen"])
+    if count >= limit:
+        break
+end_time = time.time()
+print(
+    f"Batch iteration completed in {end_time - start_time:.2f} seconds. Speed {count / (end_time - start_time):.2f} entries/sec."
+)
 print("Done.")
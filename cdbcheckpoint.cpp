@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "cdbcheckpoint.h"
+
+namespace {
+
+const char checkpoint_magic[8] = {'C', 'D', 'B', 'C', 'H', 'K', 'P', 'T'};
+const std::uint32_t checkpoint_version = 2;
+
+void write_string(std::ofstream &file, const std::string &s) {
+  std::uint32_t size = s.size();
+  file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  file.write(s.data(), size);
+}
+
+void read_string(std::ifstream &file, std::string &s) {
+  std::uint32_t size = 0;
+  file.read(reinterpret_cast<char *>(&size), sizeof(size));
+  if (!file)
+    return;
+  s.resize(size);
+  file.read(&s[0], size);
+}
+
+} // namespace
+
+bool read_checkpoint(const std::string &filename, std::uint64_t &dump_id,
+                     std::string &start, std::string &limit,
+                     std::vector<CheckpointRange> &ranges, std::string &state) {
+
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  CheckpointHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) ||
+      header.version != checkpoint_version) {
+    std::cerr << "Invalid checkpoint file " << filename << std::endl;
+    return false;
+  }
+
+  dump_id = header.dump_id;
+  read_string(file, start);
+  read_string(file, limit);
+  ranges.resize(header.num_ranges);
+  for (auto &range : ranges) {
+    std::uint8_t done = 0;
+    read_string(file, range.start);
+    read_string(file, range.limit);
+    read_string(file, range.last);
+    file.read(reinterpret_cast<char *>(&done), sizeof(done));
+    range.done = done;
+  }
+  state.resize(header.state_size);
+  file.read(&state[0], header.state_size);
+
+  if (!file) {
+    std::cerr << "Truncated checkpoint file " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool write_checkpoint(const std::string &filename, std::uint64_t dump_id,
+                      const std::string &start, const std::string &limit,
+                      const std::vector<CheckpointRange> &ranges,
+                      const std::string &state) {
+
+  CheckpointHeader header;
+  std::memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+  header.version = checkpoint_version;
+  header.reserved = 0;
+  header.num_ranges = ranges.size();
+  header.state_size = state.size();
+  header.dump_id = dump_id;
+
+  // write to a temporary name, and rename when complete, so that a crash
+  // while writing leaves the previous checkpoint intact
+  const std::string part_filename = filename + ".part";
+  std::ofstream file(part_filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to create checkpoint file " << part_filename
+              << std::endl;
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  write_string(file, start);
+  write_string(file, limit);
+  for (auto &range : ranges) {
+    std::uint8_t done = range.done;
+    write_string(file, range.start);
+    write_string(file, range.limit);
+    write_string(file, range.last);
+    file.write(reinterpret_cast<const char *>(&done), sizeof(done));
+  }
+  file.write(state.data(), state.size());
+  file.flush();
+  file.close();
+
+  if (!file || std::rename(part_filename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Failed to write checkpoint file " << filename << std::endl;
+    std::remove(part_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// A checkpoint of a scan: its key ranges, the last key processed in each range
+// and whether the range is done, plus the serialized state of the caller. The
+// ranges are stored rather than recomputed, so that a scan resumes with exactly
+// the same partitioning. The header records the identity of the dump, and is
+// followed by the start and limit keys of the scan, as a checkpoint can only
+// be resumed by the same scan of the same dump.
+//
+struct CheckpointHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint64_t num_ranges;
+  std::uint64_t state_size;
+  std::uint64_t dump_id;
+};
+
+struct CheckpointRange {
+  std::string start;
+  std::string limit;
+  std::string last; // empty if no key has been processed yet
+  bool done = false;
+};
+
+bool read_checkpoint(const std::string &filename, std::uint64_t &dump_id,
+                     std::string &start, std::string &limit,
+                     std::vector<CheckpointRange> &ranges, std::string &state);
+bool write_checkpoint(const std::string &filename, std::uint64_t dump_id,
+                      const std::string &start, const std::string &limit,
+                      const std::vector<CheckpointRange> &ranges,
+                      const std::string &state);
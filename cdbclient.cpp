@@ -0,0 +1,232 @@
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "cdbclient.h"
+#include "cdbproto.h"
+
+namespace {
+
+// fens per GET request of a batch
+const size_t fens_per_request = 1024;
+
+struct CDBClient {
+  int fd;
+  std::string address;
+  std::mutex mutex;
+};
+
+// a connection that fails during a request is out of step with the server,
+// and is closed
+[[noreturn]] void connection_lost(CDBClient *client) {
+  if (client->fd >= 0)
+    close(client->fd);
+  client->fd = -1;
+  throw CDBClientError("Lost connection to cdbdirect_server at " +
+                       client->address);
+}
+
+// a request that can not be sent: the server may have said why before it
+// closed the connection, e.g. when refusing a client beyond its limit
+[[noreturn]] void write_failed(CDBClient *client) {
+  pollfd pfd = {client->fd, POLLIN, 0};
+  CDBFrame type;
+  std::string payload;
+  if (poll(&pfd, 1, 0) > 0 && read_frame(client->fd, type, payload) &&
+      type == CDBFrame::ERROR) {
+    close(client->fd);
+    client->fd = -1;
+    throw CDBClientError("cdbdirect_server: " + payload);
+  }
+  connection_lost(client);
+}
+
+void check_connected(CDBClient *client) {
+  if (client->fd < 0)
+    throw CDBClientError("Not connected to cdbdirect_server at " +
+                         client->address);
+}
+
+// read the reply frame of a request, which should be of the given type
+std::string read_reply(CDBClient *client, CDBFrame expected) {
+  CDBFrame type;
+  std::string payload;
+  if (!read_frame(client->fd, type, payload))
+    connection_lost(client);
+  if (type == CDBFrame::ERROR)
+    throw CDBClientError("cdbdirect_server: " + payload);
+  if (type != expected)
+    connection_lost(client);
+  return payload;
+}
+
+std::string get_request(const std::vector<std::string> &fens, size_t first,
+                        size_t last) {
+  std::string payload;
+  put(payload, std::uint32_t(last - first));
+  for (size_t i = first; i < last; i++)
+    put_string(payload, fens[i]);
+  return payload;
+}
+
+} // namespace
+
+std::uintptr_t cdbclient_connect(const std::string &address) {
+  CDBClient *client = new CDBClient;
+  client->address = address.empty() ? CDB_SERVER_ADDRESS : address;
+  client->fd = cdb_connect(client->address);
+  if (client->fd < 0) {
+    std::cerr << "Unable to connect to cdbdirect_server at " << client->address
+              << std::endl;
+    delete client;
+    return 0;
+  }
+  return reinterpret_cast<std::uintptr_t>(client);
+}
+
+std::uintptr_t cdbclient_close(std::uintptr_t handle) {
+  CDBClient *client = reinterpret_cast<CDBClient *>(handle);
+  if (client->fd >= 0)
+    close(client->fd);
+  delete client;
+  return 0;
+}
+
+std::uint64_t cdbclient_size(std::uintptr_t handle) {
+  CDBClient *client = reinterpret_cast<CDBClient *>(handle);
+  const std::lock_guard<std::mutex> lock(client->mutex);
+  check_connected(client);
+
+  if (!write_frame(client->fd, CDBFrame::SIZE, ""))
+    write_failed(client);
+  PayloadReader reader(read_reply(client, CDBFrame::SIZE));
+  std::uint64_t size = 0;
+  if (!reader.get(size))
+    connection_lost(client);
+  return size;
+}
+
+std::vector<std::pair<std::string, int>> cdbclient_get(std::uintptr_t handle,
+                                                       const std::string &fen) {
+  return cdbclient_get(handle, std::vector<std::string>{fen})[0];
+}
+
+std::vector<std::vector<std::pair<std::string, int>>>
+cdbclient_get(std::uintptr_t handle, const std::vector<std::string> &fens) {
+  CDBClient *client = reinterpret_cast<CDBClient *>(handle);
+  const std::lock_guard<std::mutex> lock(client->mutex);
+  check_connected(client);
+
+  std::vector<std::vector<std::pair<std::string, int>>> result(fens.size());
+  if (fens.empty())
+    return result;
+
+  // a single request needs no pipelining
+  if (fens.size() <= fens_per_request) {
+    if (!write_frame(client->fd, CDBFrame::GET,
+                     get_request(fens, 0, fens.size())))
+      write_failed(client);
+  }
+
+  // pipeline the requests of larger batches: all are written by a second
+  // thread, while this one reads the replies, so that neither side blocks
+  bool write_ok = true;
+  std::thread writer;
+  if (fens.size() > fens_per_request)
+    writer = std::thread([&]() {
+      for (size_t first = 0; first < fens.size() && write_ok;
+           first += fens_per_request) {
+        size_t last = std::min(first + fens_per_request, fens.size());
+        write_ok = write_frame(client->fd, CDBFrame::GET,
+                               get_request(fens, first, last));
+      }
+    });
+
+  // a rejected request is answered with ERROR, the replies of the others are
+  // still read, to stay in step with the server
+  bool read_ok = true;
+  std::string error;
+  for (size_t first = 0; first < fens.size() && read_ok;
+       first += fens_per_request) {
+    size_t last = std::min(first + fens_per_request, fens.size());
+    CDBFrame type;
+    std::string payload;
+    read_ok = read_frame(client->fd, type, payload);
+    if (read_ok && type == CDBFrame::ERROR) {
+      error = payload;
+      continue;
+    }
+    read_ok = read_ok && type == CDBFrame::GET;
+    PayloadReader reader(payload);
+    for (size_t i = first; i < last && read_ok; i++)
+      read_ok = reader.get_scored(result[i]);
+  }
+
+  if (writer.joinable())
+    writer.join();
+  if (!write_ok || !read_ok)
+    connection_lost(client);
+  if (!error.empty())
+    throw CDBClientError("cdbdirect_server: " + error);
+
+  return result;
+}
+
+void cdbclient_apply(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry) {
+  CDBClient *client = reinterpret_cast<CDBClient *>(handle);
+  const std::lock_guard<std::mutex> lock(client->mutex);
+  check_connected(client);
+
+  std::string request;
+  put(request, std::uint32_t(num_threads));
+  if (!write_frame(client->fd, CDBFrame::APPLY, request))
+    write_failed(client);
+
+  // the entries keep coming until the server has seen the STOP
+  bool proceed = true;
+  std::string fen;
+  std::vector<std::pair<std::string, int>> scored;
+  while (true) {
+    CDBFrame type;
+    std::string payload;
+    if (!read_frame(client->fd, type, payload))
+      connection_lost(client);
+    if (type == CDBFrame::DONE)
+      break;
+    if (type == CDBFrame::ERROR)
+      throw CDBClientError("cdbdirect_server: " + payload);
+    if (type != CDBFrame::ENTRIES)
+      connection_lost(client);
+    if (!proceed)
+      continue;
+
+    PayloadReader reader(payload);
+    std::uint32_t n;
+    if (!reader.get(n))
+      connection_lost(client);
+    for (std::uint32_t i = 0; i < n && proceed; i++) {
+      if (!reader.get_string(fen) || !reader.get_scored(scored))
+        connection_lost(client);
+      // the rest of the scan is not read if evaluate_entry throws
+      try {
+        proceed = evaluate_entry(fen, scored);
+      } catch (...) {
+        close(client->fd);
+        client->fd = -1;
+        throw;
+      }
+    }
+
+    if (!proceed && !write_frame(client->fd, CDBFrame::STOP, ""))
+      connection_lost(client);
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// Client of cdbdirect_server, with the interface of cdbdirect.h, so that many
+// (short-lived) jobs can share the warm cache of one opened DB. The client
+// library does not depend on terarkdb. A handle is one connection, calls on
+// the same handle are serialized; use one handle per thread for concurrency.
+//
+// address is "unix:/path/to/socket" or "host:port" (only the port for
+// localhost), by default that of cdbdirect_server. Returns 0 on failure.
+//
+// A request that fails throws CDBClientError, with the message of the server
+// for a rejected request. A connection that fails during a request is closed,
+// and all later calls on its handle throw as well.
+//
+struct CDBClientError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+std::uintptr_t cdbclient_connect(const std::string &address = "");
+std::uintptr_t cdbclient_close(std::uintptr_t handle);
+std::uint64_t cdbclient_size(std::uintptr_t handle);
+std::vector<std::pair<std::string, int>> cdbclient_get(std::uintptr_t handle,
+                                                       const std::string &fen);
+
+// probe many fens, with the requests pipelined
+std::vector<std::vector<std::pair<std::string, int>>>
+cdbclient_get(std::uintptr_t handle, const std::vector<std::string> &fens);
+
+// scan the DB on the server with num_threads threads, evaluate_entry is
+// called from the calling thread only
+void cdbclient_apply(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry);
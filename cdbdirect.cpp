@@ -1,7 +1,23 @@
 #include <algorithm>
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "rocksdb/db.h"
@@ -10,7 +26,16 @@
 #include "rocksdb/table.h"
 #include "table/terark_zip_table.h"
 
+#include "cdbcheckpoint.h"
 #include "cdbdirect.h"
+#include "cdbfilter.h"
+#include "cdbmanifest.h"
+#include "cdbmaterial.h"
+#include "cdbmovegen.h"
+#include "cdbnuma.h"
+#include "cdbprofile.h"
+#include "cdbsidecar.h"
+#include "cdbsnapshot.h"
 #include "fen2cdb.h"
 
 using namespace TERARKDB_NAMESPACE;
@@ -30,11 +55,75 @@ enum class MinPlyType { INIT, SINGLE, DUAL, NONE };
 
 struct CDB {
   DB *db;
+  std::string path;
   MinPlyType min_ply_type;
+  std::once_flag min_ply_detected;
+  std::unique_ptr<XorFilter> filter;
+  std::unique_ptr<MphfSnapshot> snapshot;
+  std::unique_ptr<RangeManifest> manifest;
+  std::unique_ptr<MaterialIndex> material;
+  bool numa = false;
+  CDBIOMode io_mode;
+  std::string db_key;    // in the registry of shared DBs
+  std::uint64_t dump_id; // see DumpIdentity
+  ReadOptions scan_read_options;
+  std::vector<std::pair<std::string, double>> open_timings;
 };
 
-// Initialize the DB given a path, and return a handle for later use
-std::uintptr_t cdbdirect_initialize(const std::string &path) {
+MinPlyType get_min_ply_type(CDB *cdb);
+
+const char *io_mode_name(CDBIOMode io_mode) {
+  switch (io_mode) {
+  case CDBIOMode::MMAP:
+    return "mmap";
+  case CDBIOMode::PREAD:
+    return "pread";
+  case CDBIOMode::DIRECT:
+    return "direct";
+  default:
+    return "auto";
+  }
+}
+
+//
+// The caches shared by all handles of the process, within one memory budget:
+// the block cache, and the table factory per I/O mode, which for DIRECT holds
+// the cache of the table data read with O_DIRECT. And the DBs open by path,
+// shared by the handles of the same dump.
+//
+struct SharedDB {
+  DB *db;
+  CDBIOMode io_mode;
+  size_t handles;
+};
+
+struct CacheRegistry {
+  std::mutex caches_mutex;
+  std::uint64_t block_cache_bytes = 32 * 1024 * 1024 * 1024LL;
+  std::uint64_t table_cache_bytes = 1 * 1024 * 1024 * 1024LL;
+  std::shared_ptr<Cache> block_cache;
+  std::shared_ptr<TableFactory> table_factories[4];
+
+  std::mutex dbs_mutex;
+  std::unordered_map<std::string, SharedDB> dbs;
+};
+
+CacheRegistry &cache_registry() {
+  static CacheRegistry registry;
+  return registry;
+}
+
+// the same for all paths of a dump, if it exists
+std::string canonical_path(const std::string &path) {
+  char resolved[PATH_MAX];
+  return realpath(path.c_str(), resolved) ? std::string(resolved) : path;
+}
+
+// a table factory for the I/O mode, with the given caches, and no block cache
+// if it is null
+std::shared_ptr<TableFactory>
+NewTableFactory(CDBIOMode io_mode, std::uint64_t table_cache_bytes,
+                const std::shared_ptr<Cache> &block_cache) {
 
   TerarkZipTableOptions tzt_options;
   // TerarkZipTable requires a temp directory other than data directory, a slow
@@ -51,61 +140,530 @@ std::uintptr_t cdbdirect_initialize(const std::string &path) {
   // bbt is entirely sequential, new format is roughly sequential on keys
   // sequential on values, i.e. just index walk costs
 
-  tzt_options.minPreadLen = 0;
+  switch (io_mode) {
+  case CDBIOMode::MMAP:
+    tzt_options.minPreadLen = -1;
+    tzt_options.cacheCapacityBytes = 0;
+    break;
+  case CDBIOMode::PREAD:
+    tzt_options.minPreadLen = 0;
+    tzt_options.cacheCapacityBytes = 0;
+    break;
+  default:
+    tzt_options.minPreadLen = 0;
+    tzt_options.cacheCapacityBytes = table_cache_bytes;
+    break;
+  }
   tzt_options.indexCacheRatio = 0.000;
-  tzt_options.cacheCapacityBytes = 1 * 1024 * 1024 * 1024LL;
 
+  // table_options.block_cache = NewLRUCache(...);
   BlockBasedTableOptions table_options;
-  // table_options.block_cache = NewLRUCache(32 * 1024 * 1024 * 1024LL);
-  table_options.block_cache = NewClockCache(32 * 1024 * 1024 * 1024LL);
-  // table_options.no_block_cache = true;
+  table_options.block_cache = block_cache;
+  table_options.no_block_cache = !block_cache;
+
+  return std::shared_ptr<TableFactory>(NewTerarkZipTableFactory(
+      tzt_options, std::shared_ptr<TableFactory>(
+                       NewBlockBasedTableFactory(table_options))));
+}
+
+// the table factory of the I/O mode shared by all handles
+std::shared_ptr<TableFactory> SharedTableFactory(CDBIOMode io_mode) {
+
+  auto &registry = cache_registry();
+  const std::lock_guard<std::mutex> lock(registry.caches_mutex);
+  auto &factory = registry.table_factories[static_cast<int>(io_mode)];
+  if (!factory) {
+    if (!registry.block_cache)
+      registry.block_cache = NewClockCache(registry.block_cache_bytes);
+    factory = NewTableFactory(io_mode, registry.table_cache_bytes,
+                              registry.block_cache);
+  }
+  return factory;
+}
+
+//
+// open the DB for reading, with the given I/O mode for the table data, and the
+// shared caches unless a table factory of its own is given
+//
+DB *OpenDB(const std::string &path, CDBIOMode io_mode,
+           const CDBOpenOptions &open_options,
+           std::shared_ptr<TableFactory> table_factory = nullptr) {
+
   Options options;
   options.IncreaseParallelism();
-  options.table_factory.reset(
-      NewTerarkZipTableFactory(tzt_options, options.table_factory));
-
-  CDB *cdb = new CDB;
 
-  // open DB
-  Status s = DB::OpenForReadOnly(options, path, &cdb->db);
+  // with max_open_files = -1 all table readers are loaded during the open, by
+  // several threads, otherwise on first access, and only a bounded number of
+  // them is kept open
+  options.max_open_files = open_options.max_open_files;
+  options.max_file_opening_threads =
+      open_options.max_file_opening_threads > 0
+          ? open_options.max_file_opening_threads
+          : std::max(1, (int)std::thread::hardware_concurrency());
+  // the table properties are not needed for statistics of a read-only DB
+  options.skip_stats_update_on_db_open = true;
+  options.table_factory =
+      table_factory ? table_factory : SharedTableFactory(io_mode);
+
+  // open DB, nullptr if it fails
+  DB *db;
+  Status s = DB::OpenForReadOnly(options, path, &db);
   if (!s.ok()) {
     std::cerr << s.ToString() << std::endl;
-    std::exit(1);
+    return nullptr;
+  }
+
+  return db;
+}
+
+//
+// The identity of a dump: a hash of the names, sizes and key ranges of its
+// table files, which the sidecar files record, so that a sidecar left over
+// from another dump at the same path is not used
+//
+std::uint64_t DumpIdentity(DB *db) {
+
+  std::vector<LiveFileMetaData> files;
+  db->GetLiveFilesMetaData(&files);
+  std::sort(files.begin(), files.end(),
+            [](const LiveFileMetaData &a, const LiveFileMetaData &b) {
+              return a.name < b.name;
+            });
+
+  std::string identity;
+  for (auto &file : files) {
+    identity += file.name + '\0' + std::to_string(file.size) + '\0';
+    identity += file.smallestkey + '\0' + file.largestkey + '\0';
+  }
+  return hash_key(identity);
+}
+
+//
+// Run a short micro-workload of random probes and sequential scans against the
+// dump with each I/O mode, and return the fastest. Each mode works on its own
+// set of table files, so that it doesn't benefit from data cached by the
+// others, and with caches of its own rather than those shared by the handles,
+// which it would otherwise warm (or find warm). The results are persisted next
+// to the dump.
+//
+CDBIOMode CalibrateIOMode(const std::string &path,
+                          const CDBOpenOptions &open_options) {
+
+  const std::vector<CDBIOMode> modes = {CDBIOMode::MMAP, CDBIOMode::PREAD,
+                                        CDBIOMode::DIRECT};
+  const size_t files_per_role = 8, probes_per_file = 256, keys_per_probe = 16,
+               entries_per_scan = 50000;
+
+  ReadOptions read_options;
+  read_options.verify_checksums = false;
+
+  std::uint64_t block_cache_bytes, table_cache_bytes;
+  {
+    auto &registry = cache_registry();
+    const std::lock_guard<std::mutex> lock(registry.caches_mutex);
+    block_cache_bytes = registry.block_cache_bytes;
+    table_cache_bytes = registry.table_cache_bytes;
+  }
+
+  // files spread evenly over the key space, alternately used per mode for
+  // probes and for scans, whose keys are read without any cache
+  std::vector<std::string> probe_keys[3], scan_starts[3];
+  {
+    DB *db = OpenDB(path, CDBIOMode::PREAD, open_options,
+                    NewTableFactory(CDBIOMode::PREAD, 0, nullptr));
+    if (!db)
+      return CDBIOMode::DIRECT;
+    std::vector<LiveFileMetaData> files;
+    db->GetLiveFilesMetaData(&files);
+    const Comparator *cmp = db->GetOptions().comparator;
+    std::sort(files.begin(), files.end(),
+              [&cmp](const LiveFileMetaData &a, const LiveFileMetaData &b) {
+                return cmp->Compare(a.smallestkey, b.smallestkey) < 0;
+              });
+
+    const size_t num_picks = 2 * files_per_role * modes.size();
+    std::unique_ptr<Iterator> it(db->NewIterator(read_options));
+    for (size_t j = 0; j < std::min(num_picks, files.size()); j++) {
+      const auto &file = files[j * files.size() / num_picks];
+      size_t m = j % modes.size();
+      if ((j / modes.size()) % 2) {
+        scan_starts[m].push_back(file.smallestkey);
+        continue;
+      }
+      // every keys_per_probe-th key of the start of the file
+      it->Seek(file.smallestkey);
+      for (size_t k = 0; it->Valid() && k < probes_per_file * keys_per_probe;
+           k++, it->Next())
+        if (k % keys_per_probe == 0)
+          probe_keys[m].push_back(it->key().ToString());
+    }
+    it.reset();
+    delete db;
+  }
+
+  std::mt19937_64 rng(42);
+  for (auto &keys : probe_keys)
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(3);
+  report << "# I/O mode calibration: mode, probe time (us), scan time (us per "
+            "entry), total (s)\n";
+
+  CDBIOMode best = CDBIOMode::DIRECT;
+  double best_time = std::numeric_limits<double>::max();
+  for (size_t m = 0; m < modes.size(); m++) {
+    DB *db = OpenDB(path, modes[m], open_options,
+                    NewTableFactory(modes[m], table_cache_bytes,
+                                    NewClockCache(block_cache_bytes)));
+    if (!db)
+      continue;
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::string value;
+    for (auto &key : probe_keys[m])
+      db->Get(read_options, key, &value);
+    auto t1 = std::chrono::steady_clock::now();
+    size_t scanned = 0;
+    {
+      std::unique_ptr<Iterator> it(db->NewIterator(read_options));
+      for (auto &start : scan_starts[m]) {
+        size_t k = 0;
+        for (it->Seek(start); it->Valid() && k < entries_per_scan;
+             it->Next(), k++)
+          value.assign(it->value().data(), it->value().size());
+        scanned += k;
+      }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    delete db;
+
+    double probe_time = std::chrono::duration<double>(t1 - t0).count();
+    double scan_time = std::chrono::duration<double>(t2 - t1).count();
+    report << io_mode_name(modes[m]) << " "
+           << 1e6 * probe_time / std::max<size_t>(probe_keys[m].size(), 1)
+           << " " << 1e6 * scan_time / std::max<size_t>(scanned, 1) << " "
+           << probe_time + scan_time << "\n";
+
+    if (probe_time + scan_time < best_time) {
+      best_time = probe_time + scan_time;
+      best = modes[m];
+    }
   }
+
+  std::cout << report.str() << "Selected I/O mode: " << io_mode_name(best)
+            << std::endl;
+
+  std::ofstream file(sidecar_path(path, "iomode"));
+  file << io_mode_name(best) << "\n" << report.str();
+
+  return best;
+}
+
+// Initialize the DB given a path, and return a handle for later use
+std::uintptr_t cdbdirect_initialize(const std::string &path) {
+  return cdbdirect_initialize(path, CDBOpenOptions());
+}
+
+std::uintptr_t cdbdirect_initialize(const std::string &path,
+                                    const CDBOpenOptions &open_options) {
+
+  auto t_start = std::chrono::steady_clock::now();
+  CDB *cdb = new CDB;
+  cdb->path = path;
+
+  // time the phases of the open
+  auto phase_done = [cdb, t_last = t_start](const std::string &phase) mutable {
+    auto t_now = std::chrono::steady_clock::now();
+    cdb->open_timings.push_back(
+        {phase, std::chrono::duration<double>(t_now - t_last).count()});
+    t_last = t_now;
+  };
+
+  // a dump already open in this process is shared, with the I/O mode and the
+  // open options of its first open
+  auto &registry = cache_registry();
+  cdb->db_key = canonical_path(path);
+  bool open_already;
+  {
+    const std::lock_guard<std::mutex> lock(registry.dbs_mutex);
+    open_already = registry.dbs.count(cdb->db_key) > 0;
+  }
+
+  // the I/O mode is given, calibrated now (without holding the registry, as
+  // it takes a while), or found by an earlier calibration
+  CDBIOMode io_mode = open_options.io_mode;
+  if (!open_already && open_options.calibrate)
+    io_mode = CalibrateIOMode(path, open_options);
+
+  const std::lock_guard<std::mutex> lock(registry.dbs_mutex);
+  auto shared = registry.dbs.find(cdb->db_key);
+  if (shared != registry.dbs.end())
+    io_mode = shared->second.io_mode;
+  else if (!open_options.calibrate && io_mode == CDBIOMode::AUTO) {
+    io_mode = CDBIOMode::DIRECT;
+    std::ifstream file(sidecar_path(path, "iomode"));
+    std::string name;
+    if (file >> name)
+      for (auto mode : {CDBIOMode::MMAP, CDBIOMode::PREAD, CDBIOMode::DIRECT})
+        if (name == io_mode_name(mode))
+          io_mode = mode;
+  }
+  phase_done("io mode");
+
+  cdb->io_mode = io_mode;
+  if (shared != registry.dbs.end()) {
+    cdb->db = shared->second.db;
+    shared->second.handles++;
+  } else {
+    cdb->db = OpenDB(path, io_mode, open_options);
+    if (!cdb->db) {
+      delete cdb;
+      if (open_options.exit_on_error)
+        std::exit(1);
+      return 0;
+    }
+    registry.dbs[cdb->db_key] = {cdb->db, io_mode, 1};
+  }
+  cdb->dump_id = DumpIdentity(cdb->db);
+  cdb->scan_read_options.verify_checksums = false;
+  cdb->scan_read_options.fill_cache = open_options.scan_fill_cache;
+  cdb->scan_read_options.readahead_size = open_options.scan_readahead_size;
+  phase_done("open tables");
+
   const auto handle = reinterpret_cast<std::uintptr_t>(cdb);
 
-  // detect the encoding scheme for min_ply with a one-off query of startpos
-  cdb->min_ply_type = MinPlyType::INIT;
-  const auto startpos = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
-  auto result = cdbdirect_get(handle, startpos);
-  int ply = result.back().second;
-  switch (ply) {
-  case 0:
-    // the legacy scheme: one min_ply for both fen and BWfen:
-    // heuristic measure for distance to root, not exact
-    cdb->min_ply_type = MinPlyType::SINGLE;
-    break;
-  case 256: // 0x0100: hi = 1, lo = 0(unset)
-    // one min_ply each for fen and BWfen:
-    // exact upper bound for distance to root and proof of legality
-    cdb->min_ply_type = MinPlyType::DUAL;
-    break;
-  default:
-    cdb->min_ply_type = MinPlyType::NONE;
-    std::cerr << "Could not detect min_ply encoding scheme, ply = " << ply
-              << std::endl;
-    std::cerr << "cdbdirect will convert any min_ply to -1." << std::endl;
-    break;
+  // detect the encoding scheme for min_ply now, or with the first probe
+  if (!open_options.lazy_min_ply)
+    get_min_ply_type(cdb);
+  phase_done("min_ply");
+
+  // use the filter for fast misses, if one of all keys has been built next to
+  // the dump, as a filter of a subset would hide all other positions
+  auto filter_file = sidecar_path(path, "filter");
+  if (file_exists(filter_file) && cdbdirect_load_filter(handle, filter_file) &&
+      cdb->filter->subset()) {
+    std::cerr << "Ignoring the filter " << filter_file
+              << " of a subset of the keys." << std::endl;
+    cdb->filter.reset();
   }
 
+  // and the snapshot of hot positions
+  auto snapshot_file = sidecar_path(path, "snapshot");
+  if (file_exists(snapshot_file))
+    cdbdirect_load_snapshot(handle, snapshot_file);
+
+  // and the manifest of the key ranges
+  auto manifest_file = sidecar_path(path, "manifest");
+  if (file_exists(manifest_file))
+    cdbdirect_load_manifest(handle, manifest_file);
+
+  // and the index of the material signatures
+  auto material_file = sidecar_path(path, "material");
+  if (file_exists(material_file))
+    cdbdirect_load_material(handle, material_file);
+  phase_done("sidecars");
+
   return handle;
 }
 
+// the budgets of the caches shared by all handles, see CacheRegistry, which
+// can only be changed while no dump is open
+bool cdbdirect_set_cache_budget(std::uint64_t block_cache_bytes,
+                                std::uint64_t table_cache_bytes) {
+  auto &registry = cache_registry();
+  const std::lock_guard<std::mutex> dbs_lock(registry.dbs_mutex);
+  if (!registry.dbs.empty()) {
+    std::cerr << "The cache budget cannot change while a DB is open."
+              << std::endl;
+    return false;
+  }
+
+  const std::lock_guard<std::mutex> caches_lock(registry.caches_mutex);
+  registry.block_cache_bytes = block_cache_bytes;
+  registry.table_cache_bytes = table_cache_bytes;
+  registry.block_cache.reset();
+  for (auto &factory : registry.table_factories)
+    factory.reset();
+  return true;
+}
+
+// the time spent in each phase of cdbdirect_initialize, in seconds
+std::vector<std::pair<std::string, double>>
+cdbdirect_open_timings(std::uintptr_t handle) {
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  return cdb->open_timings;
+}
+
+// the time and number of calls of each stage of the probe and scan pipelines,
+// summed over all threads, if the library is built with CDB_PROFILE
+std::vector<CDBStageProfile> cdbdirect_profile() {
+  std::vector<CDBStageProfile> profile;
+  for (auto &stage : profile_report())
+    profile.push_back({profile_stage_name(stage.first), stage.second.first,
+                       stage.second.second});
+  return profile;
+}
+
+void cdbdirect_profile_reset() { profile_reset(); }
+
+// Use the given filter to answer probes of positions not in the DB without
+// accessing the DB. Note that a filter built for a subset of the DB hides
+// all other positions from cdbdirect_get.
+bool cdbdirect_load_filter(std::uintptr_t handle, const std::string &filename) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  auto filter = std::make_unique<XorFilter>();
+  if (!filter->open(filename))
+    return false;
+
+  if (filter->dump_id() != cdb->dump_id) {
+    std::cerr << "The filter " << filename << " is of another dump, ignored."
+              << std::endl;
+    return false;
+  }
+
+  cdb->filter = std::move(filter);
+  return true;
+}
+
+// Use the given manifest of key ranges to partition scans, and for the exact
+// number of entries in the DB.
+bool cdbdirect_load_manifest(std::uintptr_t handle,
+                             const std::string &filename) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  auto manifest = std::make_unique<RangeManifest>();
+  if (!manifest->open(filename))
+    return false;
+
+  if (manifest->dump_id() != cdb->dump_id) {
+    std::cerr << "The manifest " << filename << " is of another dump, ignored."
+              << std::endl;
+    return false;
+  }
+
+  cdb->manifest = std::move(manifest);
+  return true;
+}
+
+// Use the given index of material signatures for cdbdirect_apply_material.
+bool cdbdirect_load_material(std::uintptr_t handle,
+                             const std::string &filename) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  auto material = std::make_unique<MaterialIndex>();
+  if (!material->open(filename))
+    return false;
+
+  if (material->dump_id() != cdb->dump_id) {
+    std::cerr << "The material index " << filename
+              << " is of another dump, ignored." << std::endl;
+    return false;
+  }
+
+  cdb->material = std::move(material);
+  return true;
+}
+
+// the ranges of the manifest, if one is loaded, with their exact number of
+// entries and bytes, and their keys
+std::vector<CDBRange> cdbdirect_ranges(std::uintptr_t handle) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  std::vector<CDBRange> ranges;
+  if (cdb->manifest) {
+    const auto &manifest = cdb->manifest->ranges();
+    for (size_t i = 0; i < manifest.size(); i++)
+      ranges.push_back(
+          {manifest[i].keys, manifest[i].bytes,
+           cdbdirect_manifest_range(handle, i, i + 1)});
+  }
+  return ranges;
+}
+
+// the keys of the ranges first up to (excluding) last of the manifest, for
+// cdbdirect_apply_range, empty (all keys) without a manifest
+CDBKeyRange cdbdirect_manifest_range(std::uintptr_t handle, size_t first,
+                                     size_t last) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  CDBKeyRange key_range;
+  if (!cdb->manifest)
+    return key_range;
+  const auto &ranges = cdb->manifest->ranges();
+  last = std::min(last, ranges.size());
+  if (first >= last) {
+    // no ranges, a range of no keys as all keys start with 'h'
+    key_range.start = key_range.limit = "\xff";
+    return key_range;
+  }
+  key_range.start = ranges[first].start;
+  if (last < ranges.size())
+    key_range.limit = ranges[last].start;
+  return key_range;
+}
+
+// Serve probes of the positions in the given snapshot from the snapshot, which
+// is mapped read-only and shared with other processes using the same file.
+bool cdbdirect_load_snapshot(std::uintptr_t handle,
+                             const std::string &filename) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  auto snapshot = std::make_unique<MphfSnapshot>();
+  if (!snapshot->open(filename))
+    return false;
+
+  // the values of another dump would shadow those of the DB
+  if (snapshot->dump_id() != cdb->dump_id) {
+    std::cerr << "The snapshot " << filename << " is of another dump, ignored."
+              << std::endl;
+    return false;
+  }
+
+  cdb->snapshot = std::move(snapshot);
+  return true;
+}
+
+// The I/O mode the DB has been opened with
+std::string cdbdirect_io_mode(std::uintptr_t handle) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  return io_mode_name(cdb->io_mode);
+}
+
+// Enable or disable NUMA aware placement of the threads of cdbdirect_apply
+void cdbdirect_set_numa(std::uintptr_t handle, bool enabled) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  cdb->numa = enabled;
+}
+
+// The number of NUMA nodes of the machine
+size_t cdbdirect_numa_nodes() { return numa_topology().size(); }
+
+// The NUMA node the calling thread is pinned to, e.g. to select per-node
+// accumulators in the function passed to cdbdirect_apply. 0 if not pinned.
+size_t cdbdirect_numa_node() { return numa_thread_node(); }
+
+// Pin the calling thread to the given NUMA node
+bool cdbdirect_numa_pin(size_t node) { return numa_pin_thread(node); }
+
 // Return the size of the DB
 std::uint64_t cdbdirect_size(std::uintptr_t handle) {
 
   CDB *cdb = reinterpret_cast<CDB *>(handle);
 
+  // exact with a manifest, an estimate otherwise
+  if (cdb->manifest)
+    return cdb->manifest->num_keys();
+
   std::uint64_t size[1];
   cdb->db->GetIntProperty("rocksdb.estimate-num-keys", size);
 
@@ -117,8 +675,17 @@ std::uintptr_t cdbdirect_finalize(std::uintptr_t handle) {
 
   CDB *cdb = reinterpret_cast<CDB *>(handle);
 
-  // safely close the DB.
-  delete cdb->db;
+  // safely close the DB, when its last handle is closed
+  {
+    auto &registry = cache_registry();
+    const std::lock_guard<std::mutex> lock(registry.dbs_mutex);
+    auto shared = registry.dbs.find(cdb->db_key);
+    if (shared == registry.dbs.end() || --shared->second.handles == 0) {
+      delete cdb->db;
+      if (shared != registry.dbs.end())
+        registry.dbs.erase(shared);
+    }
+  }
   delete cdb;
 
   return 0;
@@ -138,16 +705,78 @@ int backprop_score(int child_score) {
 }
 
 //
-// given a db key, return the fen corresponding to the key, and its BW mirror
+// given a db key, decode its position, and return the side to move in it
 //
-std::pair<std::string, std::string> key_to_fens(const std::string &key) {
+STM decode_key(const Slice &key, KeyPosition &pos) {
   // key starts with 'h' followed by binary hexfen
   assert(key.size() > 1);
   assert(key[0] == 'h');
-  auto hexfen = bin2hex(key.substr(1));
-  auto fen = cbhexfen2fen(hexfen);
-  auto BWfen = cbgetBWfen(fen);
-  return {fen, BWfen};
+  cbdecodekey(key.data() + 1, key.size() - 1, pos);
+  return pos.black ? STM::BLACK : STM::WHITE;
+}
+
+//
+// write the fen of a decoded key, or its BW mirror if fen_stm is not the key's
+// side to move, into a buffer that is reused from entry to entry
+//
+void key_position_to_fen(const KeyPosition &pos, STM key_stm, STM fen_stm,
+                         std::string &fen) {
+  char buffer[CHESS_FEN_MAX_LENGTH];
+  size_t size = cbkeyposition2fen(pos, fen_stm != key_stm, buffer);
+  fen.assign(buffer, size);
+}
+
+//
+// Decode the min_ply value of the special move a0a0 into the plies of the
+// white and black to move positions, -1 if unknown
+//
+void decode_min_ply(int ply, MinPlyType min_ply_type, int &white_ply,
+                    int &black_ply) {
+  switch (min_ply_type) {
+  case MinPlyType::SINGLE:
+    //
+    // the legacy scheme: one min_ply for both fen and BWfen
+    //
+
+    // legacy may have rare overflows into the negative numbers
+    ply = std::max(ply, -1);
+
+    if (ply >= 0) {
+      white_ply = ply % 2 ? ply + 1 : ply;
+      black_ply = ply % 2 ? ply : ply + 1;
+    }
+    break;
+
+  case MinPlyType::DUAL: {
+    //
+    // one min_ply each for fen and BWfen: ply = hi|lo = n_white|n_black,
+    // with wtm ply = 2 (n_white - 1) and btm ply = 2 n_black - 1
+    // n_white = 0 and n_black = 0 indicate that the value is undefined
+    //
+
+    white_ply = std::max(2 * (ply >> 8) - 2, -1);
+    black_ply = 2 * (ply & 0xFF) - 1;
+    break;
+  }
+
+  default:
+    //
+    // unable to decode the min_ply value, falling back to -1
+    //
+    break;
+  }
+}
+
+//
+// the side to move of the fen that is reachable (in fewer plies), if none of
+// the two is reachable, by default the key's side to move
+//
+STM reachable_stm(int white_ply, int black_ply, STM key_stm) {
+  if (white_ply >= 0 && (black_ply < 0 || white_ply < black_ply))
+    return STM::WHITE;
+  if (black_ply >= 0 && (white_ply < 0 || white_ply > black_ply))
+    return STM::BLACK;
+  return key_stm;
 }
 
 //
@@ -156,7 +785,7 @@ std::pair<std::string, std::string> key_to_fens(const std::string &key) {
 // If fen_stm == STM::NONE, then the function itself picks a fen.
 //
 std::vector<std::pair<std::string, int>>
-value_to_scoredMoves(const std::string &value, STM key_stm, STM &fen_stm,
+value_to_scoredMoves(const Slice &value, STM key_stm, STM &fen_stm,
                      MinPlyType min_ply_type) {
 
   if (value.empty()) {
@@ -164,101 +793,85 @@ value_to_scoredMoves(const std::string &value, STM key_stm, STM &fen_stm,
     return {{"a0a0", -2}};
   }
 
-  // decode the value to scoredMoves
-  std::vector<StrPair> scoredMoves;
-  get_hash_values(value, scoredMoves);
-
   std::vector<std::pair<std::string, int>> result;
-  result.reserve(scoredMoves.size());
 
-  int white_ply = -1, black_ply = -1;
-  for (auto &pair : scoredMoves) {
-    if (pair.first == "a0a0") {
-      // the special move a0a0 encodes min_ply
-      int ply = std::stoi(pair.second);
-      switch (min_ply_type) {
-      case MinPlyType::INIT:
-        //
-        // only called by cdbdirect_initialize(), to detect the min_ply scheme
-        //
-        return {{"a0a0", ply}};
-
-      case MinPlyType::SINGLE:
-        //
-        // the legacy scheme: one min_ply for both fen and BWfen
-        //
-
-        // legacy may have rare overflows into the negative numbers
-        ply = std::max(ply, -1);
-
-        if (ply >= 0) {
-          white_ply = ply % 2 ? ply + 1 : ply;
-          black_ply = ply % 2 ? ply : ply + 1;
-        }
-        break;
+  // decode the value to scoredMoves in place, in units of an int16 encoded
+  // move and an int16 score
+  size_t num_units = value.size() % 4 == 0 ? value.size() / 4 : 0;
+  result.reserve(num_units);
 
-      case MinPlyType::DUAL: {
-        //
-        // one min_ply each for fen and BWfen: ply = hi|lo = n_white|n_black,
-        // with wtm ply = 2 (n_white - 1) and btm ply = 2 n_black - 1
-        // n_white = 0 and n_black = 0 indicate that the value is undefined
-        //
+  int white_ply = -1, black_ply = -1;
+  for (size_t i = 0; i < num_units; i++) {
+    std::int16_t encoded, score;
+    std::memcpy(&encoded, value.data() + 4 * i, sizeof(encoded));
+    std::memcpy(&score, value.data() + 4 * i + 2, sizeof(score));
 
-        white_ply = std::max(2 * (ply >> 8) - 2, -1);
-        black_ply = 2 * (ply & 0xFF) - 1;
-        break;
-      }
+    if (encoded == 0) {
+      // the special move a0a0 encodes min_ply
 
-      case MinPlyType::NONE:
-        //
-        // unable to decode the min_ply value, falling back to -1
-        //
-        break;
-      }
-    } else
-      result.push_back({fen_stm == STM::NONE || fen_stm == key_stm
-                            ? pair.first
-                            : cbgetBWmove(pair.first),
-                        backprop_score(std::stoi(pair.second))});
+      //
+      // only called by cdbdirect_initialize(), to detect the min_ply scheme
+      //
+      if (min_ply_type == MinPlyType::INIT)
+        return {{"a0a0", score}};
+
+      decode_min_ply(score, min_ply_type, white_ply, black_ply);
+      continue;
+    }
+
+    char move[6];
+    int len = decode_move(encoded, move);
+    if (len < 0)
+      continue;
+    if (fen_stm != STM::NONE && fen_stm != key_stm)
+      cbmirrormove(move);
+    result.emplace_back(std::string(move, len), backprop_score(score));
   }
 
   // for the iterator, pick the fen that is reachable (in fewer plies)
-  // if none of the two is reachable, by default pick the key's fen
   if (fen_stm == STM::NONE) {
-    if (white_ply >= 0 && (black_ply < 0 || white_ply < black_ply))
-      fen_stm = STM::WHITE;
-    else if (black_ply >= 0 && (white_ply < 0 || white_ply > black_ply))
-      fen_stm = STM::BLACK;
-    else
-      fen_stm = key_stm;
+    fen_stm = reachable_stm(white_ply, black_ply, key_stm);
 
     // if fen stm and key stm differ, adjust the move notations
     if (fen_stm != key_stm)
       for (auto &pair : result)
-        pair.first = cbgetBWmove(pair.first);
+        cbmirrormove(&pair.first[0]);
   }
 
   // sort moves and add ply distance
-  std::sort(
-      result.begin(), result.end(),
-      [](const std::pair<std::string, int> &a,
-         const std::pair<std::string, int> &b) { return a.second > b.second; });
+  {
+    ProfileScope profile(ProfileStage::SORT_MOVES);
+    std::sort(result.begin(), result.end(),
+              [](const std::pair<std::string, int> &a,
+                 const std::pair<std::string, int> &b) {
+                return a.second > b.second;
+              });
+  }
 
   result.push_back({"a0a0", fen_stm == STM::WHITE ? white_ply : black_ply});
 
   return result;
 }
 
-// Probe the DB, get back a vector of moves containing the known scored moves of
-// cdb fen: a position fen *without move counters* (as they have no meaning in
-// cdb). The result vector contains pairs of moves (in uci notation) with their
-// score, sorted. As last element the vector always contains the special move
-// a0a0 with score: -2  (pos not in db), -1  (no known distance to root),
-// >=0 (shortest known distance to root).
-std::vector<std::pair<std::string, int>> cdbdirect_get(std::uintptr_t handle,
-                                                       const std::string &fen) {
+//
+// Decode an entry of a scan: the scored moves of its value, and the fen picked
+// by the value's min_ply, which is the only one written, into a buffer that the
+// caller reuses from entry to entry
+//
+std::vector<std::pair<std::string, int>>
+decode_entry(const Slice &key, const Slice &value, MinPlyType min_ply_type,
+             std::string &fen) {
+  KeyPosition pos;
+  STM key_stm = decode_key(key, pos), fen_stm = STM::NONE;
+  auto scored = value_to_scoredMoves(value, key_stm, fen_stm, min_ply_type);
+  key_position_to_fen(pos, key_stm, fen_stm, fen);
+  return scored;
+}
 
-  CDB *cdb = reinterpret_cast<CDB *>(handle);
+//
+// given a fen, return the DB key, and the side to move in the key's position
+//
+std::string fen_to_key(const std::string &fen, STM &key_stm) {
 
   // The fen or its black-white mirrored equivalent is to be probed,
   // depending on their hexfen order
@@ -266,67 +879,501 @@ std::vector<std::pair<std::string, int>> cdbdirect_get(std::uintptr_t handle,
   std::string BWfen = cbgetBWfen(fen);
   std::string BWhexfen = cbfen2hexfen(BWfen);
   STM fen_stm = fen_to_stm(fen);
-  STM key_stm = hexfen < BWhexfen ? fen_stm : inverted_stm(fen_stm);
+  key_stm = hexfen < BWhexfen ? fen_stm : inverted_stm(fen_stm);
 
-  // generate the binary fen with prefix 'h' as key, and get the value
-  std::string key = 'h' + hex2bin(std::min(hexfen, BWhexfen));
-
-  std::string value;
-  ReadOptions read_options;
-  read_options.verify_checksums = false;
-  Status s = cdb->db->Get(read_options, key, &value);
-
-  // decode the answer if we have a hit, otherwise signal failed probe
-  return value_to_scoredMoves(s.ok() ? value : "", key_stm, fen_stm,
-                              cdb->min_ply_type);
+  // generate the binary fen with prefix 'h' as key
+  return 'h' + hex2bin(std::min(hexfen, BWhexfen));
 }
 
 //
-// given a range, iterate over it, calling evaluate_entry for each entry
+// find the value of a key, in the snapshot of hot positions or in the DB. The
+// value points into the snapshot, or is pinned (in the block cache or table
+// reader) by the given PinnableSlice, and is not copied.
 //
-void IterateRange(
-    CDB *cdb, const RangeStorage &range,
-    const std::function<bool(const std::string &,
-                             const std::vector<std::pair<std::string, int>> &)>
-        &evaluate_entry) {
+bool find_value(CDB *cdb, const std::string &key, Slice &value,
+                PinnableSlice &pinned) {
+
+  const std::uint64_t hash =
+      cdb->snapshot || cdb->filter ? hash_key(key) : 0;
+
+  // the snapshot of the hot positions, if any, answers first
+  if (cdb->snapshot) {
+    const char *data;
+    size_t size;
+    if (cdb->snapshot->find(hash, data, size)) {
+      value = Slice(data, size);
+      return true;
+    }
+  }
+
+  // a negative answer of the filter is definite
+  if (cdb->filter && !cdb->filter->contain(hash))
+    return false;
 
-  const Comparator *cmp = cdb->db->GetOptions().comparator;
   ReadOptions read_options;
   read_options.verify_checksums = false;
-  std::unique_ptr<Iterator> it(cdb->db->NewIterator(read_options));
+  if (!cdb->db->Get(read_options, cdb->db->DefaultColumnFamily(), key, &pinned)
+           .ok())
+    return false;
 
-  for (it->Seek(range.start);
-       it->Valid() && (cmp->Compare(it->key(), range.limit) < 0); it->Next()) {
+  value = pinned;
+  return true;
+}
 
-    // get the key's fen and BWfen
-    auto fens = key_to_fens(it->key().ToString());
-    STM key_stm = fen_to_stm(fens.first), fen_stm = STM::NONE;
+//
+// find the values of a batch of keys, as find_value, where the keys that the
+// snapshot and the filter do not answer are looked up in one MultiGet, in key
+// order. The values are copied.
+//
+void find_values(CDB *cdb, const std::vector<std::string> &keys,
+                 std::vector<std::string> &values, std::vector<bool> &found) {
+
+  values.assign(keys.size(), std::string());
+  found.assign(keys.size(), false);
+
+  std::vector<size_t> lookups;
+  for (size_t i = 0; i < keys.size(); i++) {
+    const std::uint64_t hash =
+        cdb->snapshot || cdb->filter ? hash_key(keys[i]) : 0;
+    const char *data;
+    size_t size;
+    if (cdb->snapshot && cdb->snapshot->find(hash, data, size)) {
+      values[i].assign(data, size);
+      found[i] = true;
+    } else if (!cdb->filter || cdb->filter->contain(hash))
+      lookups.push_back(i);
+  }
+  if (lookups.empty())
+    return;
 
-    auto scored = value_to_scoredMoves(it->value().ToString(), key_stm, fen_stm,
-                                       cdb->min_ply_type);
+  std::sort(lookups.begin(), lookups.end(),
+            [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+  std::vector<Slice> lookup_keys;
+  for (auto i : lookups)
+    lookup_keys.push_back(keys[i]);
 
-    if (!evaluate_entry(key_stm == fen_stm ? fens.first : fens.second, scored))
-      break;
-  }
+  ReadOptions read_options;
+  read_options.verify_checksums = false;
+  std::vector<std::string> lookup_values;
+  auto statuses = cdb->db->MultiGet(read_options, lookup_keys, &lookup_values);
+  for (size_t j = 0; j < lookups.size(); j++)
+    if (statuses[j].ok()) {
+      values[lookups[j]] = std::move(lookup_values[j]);
+      found[lookups[j]] = true;
+    }
 }
 
 //
-// Create ranges from the SST files in the DB, and partition them evenly for all
-// threads
+// detect the encoding scheme for min_ply with a one-off query of startpos, once
+// per DB, either during open or on the first use
 //
-std::vector<RangeStorage> BuildRangesFromSSTs(DB *db, size_t num_threads) {
+MinPlyType get_min_ply_type(CDB *cdb) {
+  std::call_once(cdb->min_ply_detected, [cdb]() {
+    const std::string startpos =
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+    STM fen_stm = fen_to_stm(startpos), key_stm;
+    std::string key = fen_to_key(startpos, key_stm);
+    PinnableSlice pinned;
+    Slice value;
+    if (!find_value(cdb, key, value, pinned))
+      value.clear();
+    auto result =
+        value_to_scoredMoves(value, key_stm, fen_stm, MinPlyType::INIT);
+    int ply = result.back().second;
+    switch (ply) {
+    case 0:
+      // the legacy scheme: one min_ply for both fen and BWfen:
+      // heuristic measure for distance to root, not exact
+      cdb->min_ply_type = MinPlyType::SINGLE;
+      break;
+    case 256: // 0x0100: hi = 1, lo = 0(unset)
+      // one min_ply each for fen and BWfen:
+      // exact upper bound for distance to root and proof of legality
+      cdb->min_ply_type = MinPlyType::DUAL;
+      break;
+    default:
+      cdb->min_ply_type = MinPlyType::NONE;
+      std::cerr << "Could not detect min_ply encoding scheme, ply = " << ply
+                << std::endl;
+      std::cerr << "cdbdirect will convert any min_ply to -1." << std::endl;
+      break;
+    }
+  });
+  return cdb->min_ply_type;
+}
 
-  ReadOptions read_options;
-  read_options.verify_checksums = false;
-  std::unique_ptr<Iterator> it(db->NewIterator(read_options));
-  it->SeekToLast();
-  std::string last_key_str = it->key().ToString();
+// Probe the DB, get back a vector of moves containing the known scored moves of
+// cdb fen: a position fen *without move counters* (as they have no meaning in
+// cdb). The result vector contains pairs of moves (in uci notation) with their
+// score, sorted. As last element the vector always contains the special move
+// a0a0 with score: -2  (pos not in db), -1  (no known distance to root),
+// >=0 (shortest known distance to root).
+std::vector<std::pair<std::string, int>> cdbdirect_get(std::uintptr_t handle,
+                                                       const std::string &fen) {
 
-  std::vector<LiveFileMetaData> files;
-  db->GetLiveFilesMetaData(&files);
-  const Comparator *cmp = db->GetOptions().comparator;
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  ProfileLaps profile;
 
-  // Sort globally by smallest key (ignore level for iteration ordering)
+  STM fen_stm = fen_to_stm(fen), key_stm;
+  std::string key = fen_to_key(fen, key_stm);
+  profile.lap(ProfileStage::PROBE_KEY);
+
+  PinnableSlice pinned;
+  Slice value;
+  if (!find_value(cdb, key, value, pinned))
+    value.clear();
+  profile.lap(ProfileStage::PROBE_FIND);
+
+  // decode the answer if we have a hit, otherwise signal failed probe
+  auto result =
+      value_to_scoredMoves(value, key_stm, fen_stm, get_min_ply_type(cdb));
+  profile.lap(ProfileStage::PROBE_VALUE);
+  return result;
+}
+
+// the children of a position, generated by legal_children() and probed with
+// one batch of lookups
+std::vector<CDBChild> cdbdirect_get_children(std::uintptr_t handle,
+                                             const std::string &fen) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  ProfileLaps profile;
+
+  std::vector<std::pair<std::string, std::string>> moves;
+  if (!legal_children(fen, moves)) {
+    std::cerr << "Invalid fen " << fen << std::endl;
+    return {};
+  }
+
+  std::vector<std::string> keys(moves.size());
+  std::vector<STM> key_stms(moves.size());
+  for (size_t i = 0; i < moves.size(); i++)
+    keys[i] = fen_to_key(moves[i].second, key_stms[i]);
+  profile.lap(ProfileStage::PROBE_KEY);
+
+  std::vector<std::string> values;
+  std::vector<bool> found;
+  find_values(cdb, keys, values, found);
+  profile.lap(ProfileStage::PROBE_FIND);
+
+  const MinPlyType min_ply_type = get_min_ply_type(cdb);
+  std::vector<CDBChild> children;
+  children.reserve(moves.size());
+  for (size_t i = 0; i < moves.size(); i++) {
+    STM fen_stm = fen_to_stm(moves[i].second);
+    Slice value = found[i] ? Slice(values[i]) : Slice();
+    children.push_back(
+        {std::move(moves[i].first), std::move(moves[i].second),
+         value_to_scoredMoves(value, key_stms[i], fen_stm, min_ply_type)});
+  }
+  profile.lap(ProfileStage::PROBE_VALUE);
+
+  return children;
+}
+
+// Give scoped access to the raw value of a position, without copying it out of
+// the DB: use is called with the value bytes, which are only valid during the
+// call. mirrored is true if the moves are stored for the black-white mirrored
+// position of the fen. Returns false, without calling use, if the position is
+// not in the DB.
+bool cdbdirect_get_raw(
+    std::uintptr_t handle, const std::string &fen,
+    const std::function<void(const char *, size_t, bool)> &use) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  STM fen_stm = fen_to_stm(fen), key_stm;
+  std::string key = fen_to_key(fen, key_stm);
+
+  PinnableSlice pinned;
+  Slice value;
+  if (!find_value(cdb, key, value, pinned))
+    return false;
+
+  use(value.data(), value.size(), fen_stm != key_stm);
+  return true;
+}
+
+//
+// select the best (at most) capacity moves of a value into the caller's array,
+// sorted by score, and return min_ply
+//
+int select_best(const Slice &value, STM fen_stm, STM key_stm,
+                MinPlyType min_ply_type, CDBMove *moves, size_t capacity,
+                size_t &num_moves, size_t &total_moves) {
+
+  num_moves = 0;
+  total_moves = 0;
+  if (value.size() % 4 != 0)
+    return -1;
+
+  const size_t k = capacity;
+  int white_ply = -1, black_ply = -1;
+  for (size_t i = 0; i < value.size(); i += 4) {
+    std::int16_t encoded, score;
+    std::memcpy(&encoded, value.data() + i, sizeof(encoded));
+    std::memcpy(&score, value.data() + i + 2, sizeof(score));
+
+    // the special move a0a0 (encoded as 0) encodes min_ply
+    if (encoded == 0) {
+      decode_min_ply(score, min_ply_type, white_ply, black_ply);
+      continue;
+    }
+
+    CDBMove move;
+    if (decode_move(encoded, move.uci) < 0)
+      continue;
+    move.score = backprop_score(score);
+    total_moves++;
+
+    // insert into the moves sorted by score, if among the best k
+    if (num_moves == k && (k == 0 || move.score <= moves[k - 1].score))
+      continue;
+    size_t j = num_moves < k ? num_moves++ : k - 1;
+    for (; j > 0 && moves[j - 1].score < move.score; j--)
+      moves[j] = moves[j - 1];
+    moves[j] = move;
+  }
+
+  // the moves are stored for the key's position
+  if (fen_stm != key_stm)
+    for (size_t j = 0; j < num_moves; j++)
+      cbmirrormove(moves[j].uci);
+
+  return fen_stm == STM::WHITE ? white_ply : black_ply;
+}
+
+// Probe the DB for the (at most CDB_MAX_BEST) best k moves only. The moves are
+// selected straight from the value bytes, without sorting all moves and
+// without allocations, which makes this the fast path for annotations.
+CDBBest cdbdirect_get_best(std::uintptr_t handle, const std::string &fen,
+                           size_t k) {
+  CDBBest best;
+  best.min_ply =
+      cdbdirect_get_best(handle, fen, best.moves, std::min(k, CDB_MAX_BEST),
+                         best.num_moves, best.total_moves);
+  return best;
+}
+
+// as above, for the best (at most) capacity moves, into the caller's array
+int cdbdirect_get_best(std::uintptr_t handle, const std::string &fen,
+                       CDBMove *moves, size_t capacity, size_t &num_moves,
+                       size_t &total_moves) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  num_moves = 0;
+  total_moves = 0;
+  ProfileLaps profile;
+
+  STM fen_stm = fen_to_stm(fen), key_stm;
+  std::string key = fen_to_key(fen, key_stm);
+  profile.lap(ProfileStage::PROBE_KEY);
+
+  PinnableSlice pinned;
+  Slice value;
+  bool found = find_value(cdb, key, value, pinned);
+  profile.lap(ProfileStage::PROBE_FIND);
+  if (!found)
+    return -2;
+  ProfileScope profile_value(ProfileStage::PROBE_VALUE);
+
+  return select_best(value, fen_stm, key_stm, get_min_ply_type(cdb), moves,
+                     capacity, num_moves, total_moves);
+}
+
+// as above, for a batch of positions looked up together (see find_values),
+// with the moves of fens[i] selected into the caller's array moves_of(i)
+std::vector<int>
+cdbdirect_get_best_batch(std::uintptr_t handle,
+                         const std::vector<std::string> &fens,
+                         const std::function<CDBMove *(size_t)> &moves_of,
+                         size_t capacity, std::vector<size_t> &num_moves) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  ProfileLaps profile;
+
+  std::vector<std::string> keys(fens.size());
+  std::vector<STM> key_stms(fens.size());
+  for (size_t i = 0; i < fens.size(); i++)
+    keys[i] = fen_to_key(fens[i], key_stms[i]);
+  profile.lap(ProfileStage::PROBE_KEY);
+
+  std::vector<std::string> values;
+  std::vector<bool> found;
+  find_values(cdb, keys, values, found);
+  profile.lap(ProfileStage::PROBE_FIND);
+
+  const MinPlyType min_ply_type = get_min_ply_type(cdb);
+  std::vector<int> min_plies(fens.size(), -2);
+  num_moves.assign(fens.size(), 0);
+  for (size_t i = 0; i < fens.size(); i++) {
+    size_t total_moves;
+    if (found[i])
+      min_plies[i] = select_best(values[i], fen_to_stm(fens[i]), key_stms[i],
+                                 min_ply_type, moves_of(i), capacity,
+                                 num_moves[i], total_moves);
+  }
+  profile.lap(ProfileStage::PROBE_VALUE);
+
+  return min_plies;
+}
+
+//
+// Coordinates the threads of a scan for checkpoints: when requested, each
+// thread pauses after its current entry, recording the entry's key, so that
+// the state of the caller and the positions in all ranges are consistent.
+//
+struct ScanCheckpoints {
+  std::vector<CheckpointRange> ranges;
+  std::atomic<bool> requested{false};
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t active = 0, paused = 0, generation = 0;
+
+  // called by the thread of a range, after the entry with the given key
+  void pause(size_t index, const Slice &key) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ranges[index].last = key.ToString();
+    const size_t current = generation;
+    paused++;
+    cv.notify_all();
+    cv.wait(lock, [&] { return generation != current; });
+  }
+
+  // called by the thread of a range when it ends, either done or stopped by
+  // the caller after the entry with the given key
+  void finish(size_t index, bool done, const Slice &key) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (done)
+      ranges[index].done = true;
+    else
+      ranges[index].last = key.ToString();
+    active--;
+    cv.notify_all();
+  }
+};
+
+//
+// given a range, iterate over it, calling evaluate_entry for each entry, with
+// the reachable fen of the entry, or the fen of its key
+//
+void IterateRange(
+    CDB *cdb, const RangeStorage &range,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    ScanCheckpoints *checkpoints = nullptr, size_t index = 0,
+    bool key_orientation = false) {
+
+  const Comparator *cmp = cdb->db->GetOptions().comparator;
+  const MinPlyType min_ply_type = get_min_ply_type(cdb);
+
+  // let the iterator stop at the end of the range, rather than at the end of
+  // the table it reads
+  ReadOptions read_options = cdb->scan_read_options;
+  Slice upper_bound(range.limit);
+  if (!range.limit.empty())
+    read_options.iterate_upper_bound = &upper_bound;
+  std::unique_ptr<Iterator> it(cdb->db->NewIterator(read_options));
+  std::string fen;
+
+  // an empty limit leaves the range open ended
+  bool done = true;
+  ProfileLaps profile;
+  for (it->Seek(range.start);
+       it->Valid() &&
+       (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+       it->Next()) {
+    profile.lap(ProfileStage::SCAN_ITERATE);
+
+    // as decode_entry, in stages
+    KeyPosition pos;
+    STM key_stm = decode_key(it->key(), pos);
+    STM fen_stm = key_orientation ? key_stm : STM::NONE;
+    profile.lap(ProfileStage::SCAN_KEY);
+    auto scored =
+        value_to_scoredMoves(it->value(), key_stm, fen_stm, min_ply_type);
+    profile.lap(ProfileStage::SCAN_VALUE);
+    key_position_to_fen(pos, key_stm, fen_stm, fen);
+    profile.lap(ProfileStage::SCAN_FEN);
+
+    bool proceed = evaluate_entry(fen, scored);
+    profile.lap(ProfileStage::SCAN_CALLBACK);
+    if (!proceed) {
+      done = false;
+      break;
+    }
+
+    if (checkpoints && checkpoints->requested.load(std::memory_order_relaxed))
+      checkpoints->pause(index, it->key());
+  }
+
+  if (checkpoints)
+    checkpoints->finish(index, done, done ? Slice() : it->key());
+}
+
+//
+// given a range, iterate over its keys only, calling evaluate_key (if any) with
+// the fen of each key, in key orientation, and return the number of keys seen.
+// The values are never asked for, so that with lazily loaded values the scan
+// does not read or decode them.
+//
+std::uint64_t
+IterateKeys(CDB *cdb, const RangeStorage &range,
+            const std::function<bool(const std::string &)> &evaluate_key) {
+
+  const Comparator *cmp = cdb->db->GetOptions().comparator;
+
+  ReadOptions read_options = cdb->scan_read_options;
+  Slice upper_bound(range.limit);
+  if (!range.limit.empty())
+    read_options.iterate_upper_bound = &upper_bound;
+  std::unique_ptr<Iterator> it(cdb->db->NewIterator(read_options));
+  std::string fen;
+
+  std::uint64_t keys = 0;
+  ProfileLaps profile;
+  for (it->Seek(range.start);
+       it->Valid() &&
+       (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+       it->Next()) {
+    profile.lap(ProfileStage::SCAN_ITERATE);
+    keys++;
+    if (!evaluate_key)
+      continue;
+
+    KeyPosition pos;
+    STM key_stm = decode_key(it->key(), pos);
+    profile.lap(ProfileStage::SCAN_KEY);
+    key_position_to_fen(pos, key_stm, key_stm, fen);
+    profile.lap(ProfileStage::SCAN_FEN);
+
+    bool proceed = evaluate_key(fen);
+    profile.lap(ProfileStage::SCAN_CALLBACK);
+    if (!proceed)
+      break;
+  }
+  return keys;
+}
+
+//
+// Create ranges from the SST files in the DB, and partition them evenly for all
+// threads
+//
+std::vector<RangeStorage> BuildRangesFromSSTs(DB *db, size_t num_threads) {
+
+  ReadOptions read_options;
+  read_options.verify_checksums = false;
+  std::unique_ptr<Iterator> it(db->NewIterator(read_options));
+  it->SeekToLast();
+  std::string last_key_str = it->key().ToString();
+
+  std::vector<LiveFileMetaData> files;
+  db->GetLiveFilesMetaData(&files);
+  const Comparator *cmp = db->GetOptions().comparator;
+
+  // Sort globally by smallest key (ignore level for iteration ordering)
   std::sort(files.begin(), files.end(),
             [&cmp](const LiveFileMetaData &a, const LiveFileMetaData &b) {
               return cmp->Compare(a.smallestkey, b.smallestkey) < 0;
@@ -360,6 +1407,95 @@ std::vector<RangeStorage> BuildRangesFromSSTs(DB *db, size_t num_threads) {
   return out;
 }
 
+//
+// Partition the DB into ranges for num_threads threads, balanced by the exact
+// key counts of the manifest if available, otherwise by the SST files
+//
+std::vector<RangeStorage> BuildRanges(CDB *cdb, size_t num_threads) {
+
+  if (!cdb->manifest || cdb->manifest->ranges().empty())
+    return BuildRangesFromSSTs(cdb->db, num_threads);
+
+  std::vector<RangeStorage> ranges;
+  for (auto &part : cdb->manifest->partition(
+           num_threads, 0, cdb->manifest->ranges().size()))
+    ranges.push_back(RangeStorage(part.first, part.second));
+  return ranges;
+}
+
+//
+// restrict the ranges to the keys from start up to (excluding) limit, where an
+// empty key leaves that side open, and drop the ranges outside
+//
+std::vector<RangeStorage> ClipRanges(CDB *cdb,
+                                     const std::vector<RangeStorage> &ranges,
+                                     const std::string &start,
+                                     const std::string &limit) {
+
+  const Comparator *cmp = cdb->db->GetOptions().comparator;
+  std::vector<RangeStorage> clipped;
+  for (auto &range : ranges) {
+    std::string range_start = range.start, range_limit = range.limit;
+    if (!start.empty() && cmp->Compare(range_start, start) < 0)
+      range_start = start;
+    if (!limit.empty() &&
+        (range_limit.empty() || cmp->Compare(limit, range_limit) < 0))
+      range_limit = limit;
+    if (range_limit.empty() || cmp->Compare(range_start, range_limit) < 0)
+      clipped.push_back(RangeStorage(range_start, range_limit));
+  }
+  return clipped;
+}
+
+//
+// Partition the keys from start up to (excluding) limit into ranges for
+// num_threads threads: a finer partition of the whole DB is clipped, and its
+// consecutive pieces are grouped
+//
+std::vector<RangeStorage> BuildRanges(CDB *cdb, size_t num_threads,
+                                      const std::string &start,
+                                      const std::string &limit) {
+
+  if (start.empty() && limit.empty())
+    return BuildRanges(cdb, num_threads);
+
+  const size_t oversampling = 16;
+  auto pieces = ClipRanges(cdb, BuildRanges(cdb, num_threads * oversampling),
+                           start, limit);
+
+  std::vector<RangeStorage> ranges;
+  const size_t num_ranges = std::min(num_threads, pieces.size());
+  for (size_t i = 0; i < num_ranges; i++) {
+    size_t first = i * pieces.size() / num_ranges,
+           last = (i + 1) * pieces.size() / num_ranges;
+    ranges.push_back(RangeStorage(pieces[first].start, pieces[last - 1].limit));
+  }
+  return ranges;
+}
+
+//
+// run the given function for each range in a thread of its own. With NUMA
+// placement, consecutive ranges are assigned to the same node, and the threads
+// are pinned to the node of their range.
+//
+void RunOnRanges(CDB *cdb, const std::vector<RangeStorage> &ranges,
+                 const std::function<void(const RangeStorage &)> &work) {
+
+  const size_t num_nodes = cdb->numa ? numa_topology().size() : 1;
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < ranges.size(); i++) {
+    size_t node = i * num_nodes / ranges.size();
+    workers.emplace_back([&ranges, &work, i, node, num_nodes]() {
+      if (num_nodes > 1)
+        numa_pin_thread(node);
+      work(ranges[i]);
+    });
+  }
+  for (auto &t : workers)
+    t.join();
+}
+
 //
 // apply the given function to all entries in the DB, using multiple threads
 // the function receives the fen and the scored moves vector, and can return
@@ -371,14 +1507,874 @@ void cdbdirect_apply(
                              const std::vector<std::pair<std::string, int>> &)>
         &evaluate_entry) {
 
+  cdbdirect_apply_range(handle, num_threads, evaluate_entry, CDBKeyRange());
+}
+
+//
+// as cdbdirect_apply, for the entries of a range of keys only
+//
+void cdbdirect_apply_range(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const CDBKeyRange &key_range) {
+
   CDB *cdb = reinterpret_cast<CDB *>(handle);
 
-  auto ranges = BuildRangesFromSSTs(cdb->db, num_threads);
+  auto ranges =
+      BuildRanges(cdb, num_threads, key_range.start, key_range.limit);
+
+  RunOnRanges(cdb, ranges, [&](const RangeStorage &range) {
+    IterateRange(cdb, range, evaluate_entry);
+  });
+}
+
+//
+// as cdbdirect_apply_range, for the keys only: the fen of each entry, in key
+// orientation, without reading its value. Returns the number of keys scanned,
+// which is the exact number of entries of the range for a complete scan, also
+// without evaluate_key.
+//
+std::uint64_t cdbdirect_apply_keys(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &)> &evaluate_key,
+    const CDBKeyRange &key_range) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  auto ranges =
+      BuildRanges(cdb, num_threads, key_range.start, key_range.limit);
+
+  std::atomic<std::uint64_t> keys(0);
+  RunOnRanges(cdb, ranges, [&](const RangeStorage &range) {
+    keys += IterateKeys(cdb, range, evaluate_key);
+  });
+  return keys;
+}
+
+//
+// Scan the positions with the given leading ranks, from rank 8, which share
+// the prefix of their hexfen and thus are adjacent in key order. An odd number
+// of hex digits ends the prefix in the high nibble of a byte.
+//
+bool cdbdirect_scan_prefix(
+    std::uintptr_t handle, size_t num_threads, const std::string &ranks,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  std::string hexfen = cbranks2hexfen(ranks);
+  if (hexfen.empty()) {
+    std::cerr << "Invalid ranks " << ranks << ", expected complete ranks from "
+              << "rank 8, e.g. r3k2r/pppppppp" << std::endl;
+    return false;
+  }
 
+  // the keys from the prefix (with a low nibble of 0) up to the next prefix
+  std::string prefix = 'h' + hex2bin(hexfen.substr(0, hexfen.size() & ~1));
+  std::string start = prefix, limit = prefix;
+  if (hexfen.size() % 2) {
+    start += hex2bin(hexfen.substr(hexfen.size() - 1) + "0");
+    limit += hex2bin(hexfen.substr(hexfen.size() - 1) + "f");
+  }
+  while (static_cast<unsigned char>(limit.back()) == 0xff)
+    limit.pop_back();
+  limit.back()++;
+
+  auto ranges = BuildRanges(cdb, num_threads, start, limit);
+  RunOnRanges(cdb, ranges, [&](const RangeStorage &range) {
+    IterateRange(cdb, range, evaluate_entry, nullptr, 0, true);
+  });
+  return true;
+}
+
+//
+// The key range of shard number shard (counting from 0) of num_shards shards,
+// which are cut at the smallest keys of the SST files, so that the shards have
+// about the same size on disk. As the cuts only depend on the SST metadata,
+// all copies of a dump agree on the shards, and the shards cover all keys.
+//
+CDBKeyRange cdbdirect_shard(std::uintptr_t handle, size_t shard,
+                            size_t num_shards) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  assert(shard < num_shards);
+
+  std::vector<LiveFileMetaData> files;
+  cdb->db->GetLiveFilesMetaData(&files);
+  const Comparator *cmp = cdb->db->GetOptions().comparator;
+  std::sort(files.begin(), files.end(),
+            [&cmp](const LiveFileMetaData &a, const LiveFileMetaData &b) {
+              return cmp->Compare(a.smallestkey, b.smallestkey) < 0;
+            });
+
+  std::uint64_t total = 0;
+  std::string last_key;
+  for (auto &file : files) {
+    total += file.size;
+    if (cmp->Compare(file.largestkey, last_key) > 0)
+      last_key = file.largestkey;
+  }
+  // past the last key, for the shards beyond the last file
+  const std::string end = last_key + '\xff';
+
+  // cut k is the smallest key of the first file that starts at or after k /
+  // num_shards of the total size, the first and last cuts are open ended
+  auto cut = [&](size_t k) -> std::string {
+    if (k == 0 || k == num_shards)
+      return "";
+    std::uint64_t sum = 0;
+    for (auto &file : files) {
+      if (sum * num_shards >= k * total)
+        return file.smallestkey;
+      sum += file.size;
+    }
+    return end;
+  };
+
+  return {cut(shard), cut(shard + 1)};
+}
+
+//
+// apply the given function to all entries in the DB, in key order. The DB is
+// split in chunks, which are read and decoded ahead by num_threads threads,
+// in blocks of entries, into a bounded reorder buffer. The function is called
+// from the calling thread only, and can return false to stop iteration early.
+// Non-empty start and stop fens restrict the scan to the keys from the key of
+// start up to (excluding) the key of stop.
+//
+void cdbdirect_apply_ordered(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const std::string &start, const std::string &stop) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+  STM key_stm;
+
+  using Scored = std::vector<std::pair<std::string, int>>;
+  using Block = std::vector<std::pair<std::string, Scored>>;
+
+  // the buffer holds at most window chunks, each at most blocks_per_chunk
+  // blocks of block_size entries
+  const size_t block_size = 1024, blocks_per_chunk = 4, chunks_per_thread = 8;
+  const size_t window = 2 * num_threads;
+  const auto chunks =
+      BuildRanges(cdb, num_threads * chunks_per_thread,
+                  start.empty() ? "" : fen_to_key(start, key_stm),
+                  stop.empty() ? "" : fen_to_key(stop, key_stm));
+
+  std::mutex mutex;
+  std::condition_variable ready, space;
+  std::vector<std::deque<Block>> queues(chunks.size());
+  std::vector<bool> done(chunks.size(), false);
+  size_t next_chunk = 0, current = 0;
+  bool stopped = false;
+
+  // the chunks are taken in order, so the one consumed next always has a
+  // thread working on it
+  auto work = [&]() {
+    while (true) {
+      size_t c;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopped || next_chunk == chunks.size())
+          return;
+        c = next_chunk++;
+        space.wait(lock, [&] { return stopped || c < current + window; });
+        if (stopped)
+          return;
+      }
+
+      Block block;
+      auto push = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [&] {
+          return stopped || queues[c].size() < blocks_per_chunk;
+        });
+        if (stopped)
+          return false;
+        queues[c].push_back(std::move(block));
+        block = Block();
+        ready.notify_all();
+        return true;
+      };
+
+      IterateRange(cdb, chunks[c],
+                   [&](const std::string &fen, const Scored &scored) {
+                     block.emplace_back(fen, scored);
+                     return block.size() < block_size || push();
+                   });
+      if (!block.empty())
+        push();
+
+      const std::lock_guard<std::mutex> lock(mutex);
+      done[c] = true;
+      ready.notify_all();
+    }
+  };
+
+  const size_t num_nodes = cdb->numa ? numa_topology().size() : 1;
   std::vector<std::thread> workers;
-  for (auto &r : ranges) {
-    workers.emplace_back(IterateRange, cdb, r, evaluate_entry);
+  for (size_t t = 0; t < num_threads; t++)
+    workers.emplace_back([&work, t, num_threads, num_nodes]() {
+      if (num_nodes > 1)
+        numa_pin_thread(t * num_nodes / num_threads);
+      work();
+    });
+
+  // consume the blocks of the chunks in order
+  std::unique_lock<std::mutex> lock(mutex);
+  while (current < chunks.size() && !stopped) {
+    ready.wait(lock, [&] { return !queues[current].empty() || done[current]; });
+    if (queues[current].empty()) {
+      current++;
+      space.notify_all();
+      continue;
+    }
+
+    Block block = std::move(queues[current].front());
+    queues[current].pop_front();
+    space.notify_all();
+    lock.unlock();
+
+    bool proceed = true;
+    for (auto &entry : block)
+      if (!(proceed = evaluate_entry(entry.first, entry.second)))
+        break;
+
+    lock.lock();
+    stopped = !proceed;
   }
+  stopped = true;
+  space.notify_all();
+  lock.unlock();
+
   for (auto &t : workers)
     t.join();
 }
+
+//
+// apply the given function to all entries in the DB, as above, but with
+// periodic checkpoints, from which a later call resumes after a crash. The
+// positions in all ranges are written together with the state of the caller
+// (from checkpoint.save, called from the calling thread while all threads are
+// paused), which is restored with checkpoint.load when resuming. Returns
+// COMPLETED if the scan has completed, in which case the checkpoint file is
+// removed, STOPPED if the caller stopped it and the checkpoint is written,
+// and FAILED if the final checkpoint could not be written, or if the scan did
+// not start: the checkpoint file is invalid, or of another dump or key range,
+// or the interval is not positive.
+//
+CDBScanStatus cdbdirect_apply(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const CDBCheckpoint &checkpoint) {
+
+  return cdbdirect_apply_range(handle, num_threads, evaluate_entry,
+                               CDBKeyRange(), checkpoint);
+}
+
+//
+// as cdbdirect_apply with checkpoints, for the entries of a range of keys only
+//
+CDBScanStatus cdbdirect_apply_range(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const CDBKeyRange &key_range, const CDBCheckpoint &checkpoint) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  if (!(checkpoint.interval > 0)) {
+    std::cerr << "The checkpoint interval must be positive." << std::endl;
+    return CDBScanStatus::FAILED;
+  }
+
+  // resume from the checkpoint, which must be of the same scan, as its ranges
+  // and the state of the caller are, or start a new scan
+  ScanCheckpoints checkpoints;
+  std::string state;
+  if (file_exists(checkpoint.filename)) {
+    std::uint64_t dump_id;
+    std::string start, limit;
+    if (!read_checkpoint(checkpoint.filename, dump_id, start, limit,
+                         checkpoints.ranges, state))
+      return CDBScanStatus::FAILED;
+    if (dump_id != cdb->dump_id || start != key_range.start ||
+        limit != key_range.limit) {
+      std::cerr << "The checkpoint " << checkpoint.filename
+                << " is of another dump or key range." << std::endl;
+      return CDBScanStatus::FAILED;
+    }
+    if (checkpoint.load)
+      checkpoint.load(state);
+  } else
+    for (auto &range :
+         BuildRanges(cdb, num_threads, key_range.start, key_range.limit))
+      checkpoints.ranges.push_back({range.start, range.limit, "", false});
+
+  // the ranges not done yet, continued after their last key (key + '\0' being
+  // the next possible key)
+  std::vector<RangeStorage> ranges;
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < checkpoints.ranges.size(); i++) {
+    auto &range = checkpoints.ranges[i];
+    if (range.done)
+      continue;
+    ranges.push_back(RangeStorage(
+        range.last.empty() ? range.start : range.last + '\0', range.limit));
+    indices.push_back(i);
+  }
+  checkpoints.active = ranges.size();
+
+  auto write = [&]() {
+    return write_checkpoint(checkpoint.filename, cdb->dump_id, key_range.start,
+                            key_range.limit, checkpoints.ranges,
+                            checkpoint.save ? checkpoint.save() : "");
+  };
+
+  std::thread scan([&]() {
+    RunOnRanges(cdb, ranges, [&](const RangeStorage &range) {
+      IterateRange(cdb, range, evaluate_entry, &checkpoints,
+                   indices[&range - ranges.data()]);
+    });
+  });
+
+  // checkpoint periodically, with all threads paused, until all ranges ended
+  const auto interval = std::chrono::duration<double>(checkpoint.interval);
+  std::unique_lock<std::mutex> lock(checkpoints.mutex);
+  while (!checkpoints.cv.wait_for(
+      lock, interval, [&] { return checkpoints.active == 0; })) {
+    checkpoints.requested = true;
+    checkpoints.cv.wait(
+        lock, [&] { return checkpoints.paused == checkpoints.active; });
+    // a failed checkpoint leaves the previous one, the scan goes on
+    if (!write())
+      std::cerr << "Continuing the scan without this checkpoint." << std::endl;
+    checkpoints.requested = false;
+    checkpoints.paused = 0;
+    checkpoints.generation++;
+    checkpoints.cv.notify_all();
+  }
+  lock.unlock();
+  scan.join();
+
+  // done, or stopped by the caller, to be continued from here
+  bool completed = true;
+  for (auto &range : checkpoints.ranges)
+    completed = completed && range.done;
+  if (completed) {
+    std::remove(checkpoint.filename.c_str());
+    return CDBScanStatus::COMPLETED;
+  }
+  return write() ? CDBScanStatus::STOPPED : CDBScanStatus::FAILED;
+}
+
+//
+// Build a filter of the keys of all entries in the DB, or of those selected by
+// the given function (called concurrently from num_threads threads), and write
+// it to filename. A filter of all keys is by default written next to the dump,
+// where cdbdirect_initialize will pick it up, a filter of selected keys needs
+// a filename, as it would hide all other positions.
+//
+bool cdbdirect_build_filter(
+    std::uintptr_t handle, size_t num_threads, const std::string &filename,
+    const std::function<bool(const std::string &,
+                              const std::vector<std::pair<std::string, int>> &)>
+        &select) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  if (select && filename.empty()) {
+    std::cerr << "A filter of selected keys needs a filename." << std::endl;
+    return false;
+  }
+
+  XorFilterBuilder builder(
+      filename.empty() ? sidecar_path(cdb->path, "filter") : filename,
+      cdbdirect_size(handle), cdb->dump_id, bool(select));
+
+  auto collect = [&](const RangeStorage &range) {
+    const Comparator *cmp = cdb->db->GetOptions().comparator;
+    std::unique_ptr<Iterator> it(cdb->db->NewIterator(cdb->scan_read_options));
+    const MinPlyType min_ply_type = get_min_ply_type(cdb);
+    XorFilterBuilder::Sink sink(builder);
+    std::string fen;
+
+    for (it->Seek(range.start);
+         it->Valid() &&
+         (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+         it->Next()) {
+
+      if (select) {
+        auto scored = decode_entry(it->key(), it->value(), min_ply_type, fen);
+        if (!select(fen, scored))
+          continue;
+      }
+
+      sink.add(hash_key(it->key().data(), it->key().size()));
+    }
+  };
+
+  auto ranges = BuildRanges(cdb, num_threads);
+  RunOnRanges(cdb, ranges, collect);
+
+  return builder.finish(num_threads);
+}
+
+//
+// Build a snapshot of the entries selected by the given function (called
+// concurrently from num_threads threads), and write it to filename, by default
+// next to the dump where cdbdirect_initialize will pick it up.
+//
+bool cdbdirect_build_snapshot(
+    std::uintptr_t handle, size_t num_threads, const std::string &filename,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &select) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  std::mutex entries_mutex;
+  std::vector<std::pair<std::uint64_t, std::string>> entries;
+
+  auto collect = [&](const RangeStorage &range) {
+    const Comparator *cmp = cdb->db->GetOptions().comparator;
+    std::unique_ptr<Iterator> it(cdb->db->NewIterator(cdb->scan_read_options));
+    const MinPlyType min_ply_type = get_min_ply_type(cdb);
+    std::vector<std::pair<std::uint64_t, std::string>> selected;
+    std::string fen;
+
+    for (it->Seek(range.start);
+         it->Valid() &&
+         (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+         it->Next()) {
+
+      auto scored = decode_entry(it->key(), it->value(), min_ply_type, fen);
+      if (select(fen, scored))
+        selected.push_back(
+            {hash_key(it->key().data(), it->key().size()),
+             it->value().ToString()});
+    }
+
+    const std::lock_guard<std::mutex> lock(entries_mutex);
+    std::move(selected.begin(), selected.end(), std::back_inserter(entries));
+  };
+
+  auto ranges = BuildRanges(cdb, num_threads);
+  RunOnRanges(cdb, ranges, collect);
+
+  return write_snapshot(
+      filename.empty() ? sidecar_path(cdb->path, "snapshot") : filename,
+      cdb->dump_id, entries);
+}
+
+//
+// Build a snapshot of the given fens, as far as they are in the DB
+//
+bool cdbdirect_build_snapshot(std::uintptr_t handle,
+                              const std::vector<std::string> &fens,
+                              const std::string &filename) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  std::vector<std::pair<std::uint64_t, std::string>> entries;
+  ReadOptions read_options;
+  read_options.verify_checksums = false;
+  for (auto &fen : fens) {
+    STM key_stm;
+    std::string key = fen_to_key(fen, key_stm);
+    std::string value;
+    if (cdb->db->Get(read_options, key, &value).ok())
+      entries.push_back({hash_key(key), value});
+  }
+
+  return write_snapshot(
+      filename.empty() ? sidecar_path(cdb->path, "snapshot") : filename,
+      cdb->dump_id, entries);
+}
+
+//
+// the content of a value in a form that can be compared across dumps: the
+// encoded moves with their scores in canonical order, and the min_ply of both
+// sides, decoded from the min_ply encoding scheme of the dump
+//
+struct NormalizedValue {
+  std::vector<std::pair<std::int16_t, std::int16_t>> moves;
+  int white_ply = -1, black_ply = -1;
+
+  // the min_ply of the position in either orientation, -1 if unknown, which is
+  // all that the legacy scheme records: its other side is derived from it
+  int min_ply() const {
+    if (white_ply < 0 || black_ply < 0)
+      return std::max(white_ply, black_ply);
+    return std::min(white_ply, black_ply);
+  }
+};
+
+NormalizedValue normalize_value(const Slice &value, MinPlyType min_ply_type) {
+  NormalizedValue normalized;
+  for (size_t i = 0; i + 4 <= value.size(); i += 4) {
+    std::int16_t move, score;
+    std::memcpy(&move, value.data() + i, sizeof(move));
+    std::memcpy(&score, value.data() + i + 2, sizeof(score));
+    // the special move a0a0 is encoded as 0
+    if (move == 0)
+      decode_min_ply(score, min_ply_type, normalized.white_ply,
+                     normalized.black_ply);
+    else
+      normalized.moves.push_back({move, score});
+  }
+  std::sort(normalized.moves.begin(), normalized.moves.end());
+  return normalized;
+}
+
+//
+// walk a range of two dumps in lockstep, reporting the differences
+//
+void DiffRange(
+    CDB *cdb_old, CDB *cdb_new, const RangeStorage &range,
+    bool compare_min_ply,
+    const std::function<bool(CDBDiff, const std::string &,
+                             const std::vector<std::pair<std::string, int>> &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &report) {
+
+  const Comparator *cmp = cdb_new->db->GetOptions().comparator;
+  const MinPlyType min_ply_type_old = get_min_ply_type(cdb_old),
+                   min_ply_type_new = get_min_ply_type(cdb_new);
+  std::unique_ptr<Iterator> it_old(
+      cdb_old->db->NewIterator(cdb_old->scan_read_options));
+  std::unique_ptr<Iterator> it_new(
+      cdb_new->db->NewIterator(cdb_new->scan_read_options));
+  std::string fen;
+
+  // an empty limit leaves the range open ended
+  auto in_range = [&](Iterator *it) {
+    return it->Valid() &&
+           (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+  };
+
+  // the fen is picked according to the newer dump, if the entry is in it, and
+  // the moves of both dumps are given for this fen
+  auto report_entry = [&](CDBDiff diff, const Slice &key,
+                          const Slice &value_old, const Slice &value_new) {
+    KeyPosition pos;
+    STM key_stm = decode_key(key, pos), fen_stm = STM::NONE;
+    auto scored_new =
+        value_to_scoredMoves(value_new, key_stm, fen_stm, min_ply_type_new);
+    auto scored_old =
+        value_to_scoredMoves(value_old, key_stm, fen_stm, min_ply_type_old);
+    key_position_to_fen(pos, key_stm, fen_stm, fen);
+    return report(diff, fen, scored_old, scored_new);
+  };
+
+  auto same_content = [&](const Slice &value_old, const Slice &value_new) {
+    // identical bytes are the common case, and need no decoding
+    if (min_ply_type_old == min_ply_type_new &&
+        value_old.compare(value_new) == 0)
+      return true;
+    auto old_normalized = normalize_value(value_old, min_ply_type_old);
+    auto new_normalized = normalize_value(value_new, min_ply_type_new);
+    if (old_normalized.moves != new_normalized.moves)
+      return false;
+    if (!compare_min_ply)
+      return true;
+    // across schemes only the min_ply of either orientation is comparable
+    if (min_ply_type_old != min_ply_type_new)
+      return old_normalized.min_ply() == new_normalized.min_ply();
+    return old_normalized.white_ply == new_normalized.white_ply &&
+           old_normalized.black_ply == new_normalized.black_ply;
+  };
+
+  it_old->Seek(range.start);
+  it_new->Seek(range.start);
+  bool proceed = true;
+  while (proceed) {
+    bool has_old = in_range(it_old.get()), has_new = in_range(it_new.get());
+    if (!has_old && !has_new)
+      break;
+
+    int c = !has_old   ? 1
+            : !has_new ? -1
+                       : cmp->Compare(it_old->key(), it_new->key());
+    if (c < 0) {
+      proceed = report_entry(CDBDiff::REMOVED, it_old->key(), it_old->value(),
+                             Slice());
+      it_old->Next();
+    } else if (c > 0) {
+      proceed = report_entry(CDBDiff::ADDED, it_new->key(), Slice(),
+                             it_new->value());
+      it_new->Next();
+    } else {
+      if (!same_content(it_old->value(), it_new->value()))
+        proceed = report_entry(CDBDiff::CHANGED, it_new->key(),
+                               it_old->value(), it_new->value());
+      it_old->Next();
+      it_new->Next();
+    }
+  }
+}
+
+//
+// Build the manifest of the key ranges of the DB, with ranges of (at most)
+// keys_per_range entries, and write it to filename, by default next to the
+// dump where cdbdirect_initialize will pick it up.
+//
+bool cdbdirect_build_manifest(std::uintptr_t handle, size_t num_threads,
+                              const std::string &filename,
+                              size_t keys_per_range) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  auto ranges = BuildRangesFromSSTs(cdb->db, num_threads);
+  ranges.front().start.clear();
+  ranges.back().limit.clear();
+  std::vector<std::vector<ManifestRange>> counted(ranges.size());
+
+  auto count = [&](const RangeStorage &range) {
+    const Comparator *cmp = cdb->db->GetOptions().comparator;
+    std::unique_ptr<Iterator> it(cdb->db->NewIterator(cdb->scan_read_options));
+    auto &out = counted[&range - ranges.data()];
+
+    for (it->Seek(range.start);
+         it->Valid() &&
+         (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+         it->Next()) {
+      if (out.empty() || out.back().keys == keys_per_range) {
+        out.emplace_back();
+        out.back().start = it->key().ToString();
+      }
+      out.back().keys++;
+      out.back().bytes += it->key().size() + it->value().size();
+    }
+  };
+
+  RunOnRanges(cdb, ranges, count);
+
+  std::vector<ManifestRange> manifest;
+  for (auto &out : counted)
+    std::move(out.begin(), out.end(), std::back_inserter(manifest));
+
+  // the first range covers all keys before it as well
+  if (manifest.empty())
+    manifest.emplace_back();
+  manifest.front().start.clear();
+
+  return write_manifest(
+      filename.empty() ? sidecar_path(cdb->path, "manifest") : filename,
+      cdb->dump_id, manifest);
+}
+
+//
+// Build the index of the material signatures of the entries with at most
+// max_pieces pieces, in blocks of keys_per_block keys, and write it to
+// filename, by default next to the dump where cdbdirect_initialize will pick
+// it up.
+//
+bool cdbdirect_build_material(std::uintptr_t handle, size_t num_threads,
+                              const std::string &filename, size_t max_pieces,
+                              size_t keys_per_block) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  // the blocks and postings of each range, with the blocks numbered per range
+  struct Part {
+    std::vector<std::string> blocks;
+    std::unordered_map<std::uint64_t, MaterialPostings> postings;
+  };
+  auto ranges = BuildRanges(cdb, num_threads);
+  std::vector<Part> parts(ranges.size());
+
+  auto index = [&](const RangeStorage &range) {
+    const Comparator *cmp = cdb->db->GetOptions().comparator;
+    std::unique_ptr<Iterator> it(cdb->db->NewIterator(cdb->scan_read_options));
+    auto &part = parts[&range - ranges.data()];
+    size_t keys = 0;
+
+    for (it->Seek(range.start);
+         it->Valid() &&
+         (range.limit.empty() || cmp->Compare(it->key(), range.limit) < 0);
+         it->Next()) {
+      if (keys++ % keys_per_block == 0)
+        part.blocks.push_back(it->key().ToString());
+
+      KeyPosition pos;
+      decode_key(it->key(), pos);
+      std::uint64_t material = position_material(pos);
+      if (material_pieces(material) > int(max_pieces))
+        continue;
+
+      auto &posting = part.postings[canonical_material(material)];
+      std::uint32_t block = part.blocks.size() - 1;
+      if (posting.blocks.empty() || posting.blocks.back() != block)
+        posting.blocks.push_back(block);
+      posting.entries++;
+    }
+  };
+
+  RunOnRanges(cdb, ranges, index);
+
+  // number the blocks of all ranges consecutively
+  std::vector<std::string> blocks;
+  std::unordered_map<std::uint64_t, MaterialPostings> postings;
+  for (auto &part : parts) {
+    std::uint32_t offset = blocks.size();
+    std::move(part.blocks.begin(), part.blocks.end(),
+              std::back_inserter(blocks));
+    for (auto &posting : part.postings) {
+      auto &merged = postings[posting.first];
+      merged.entries += posting.second.entries;
+      for (auto block : posting.second.blocks)
+        merged.blocks.push_back(offset + block);
+    }
+  }
+
+  // the first block covers all keys before it as well
+  if (blocks.empty())
+    blocks.emplace_back();
+  blocks.front().clear();
+
+  return write_material(
+      filename.empty() ? sidecar_path(cdb->path, "material") : filename,
+      cdb->dump_id, max_pieces, keys_per_block, blocks, postings);
+}
+
+//
+// apply the given function to all entries of the given material signature,
+// e.g. "KRPvKR" (for both colour assignments), using multiple threads. Only
+// the blocks of keys which the material index lists for the signature are
+// read. The function can return false to stop iteration early. Returns false
+// if there is no index, or the signature is invalid or not indexed.
+//
+bool cdbdirect_apply_material(
+    std::uintptr_t handle, size_t num_threads, const std::string &signature,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry) {
+
+  CDB *cdb = reinterpret_cast<CDB *>(handle);
+
+  std::uint64_t material;
+  if (!cdb->material) {
+    std::cerr << "No material index, see cdbdirect_build_material."
+              << std::endl;
+    return false;
+  }
+  if (!parse_material(signature, material)) {
+    std::cerr << "Invalid material signature " << signature << std::endl;
+    return false;
+  }
+  if (material_pieces(material) > int(cdb->material->max_pieces())) {
+    std::cerr << "The material index holds signatures of at most "
+              << cdb->material->max_pieces() << " pieces." << std::endl;
+    return false;
+  }
+
+  const MaterialPostings *posting = cdb->material->find(material);
+  if (!posting)
+    return true;
+
+  // runs of consecutive blocks are read as one range
+  const auto &blocks = cdb->material->blocks();
+  std::vector<RangeStorage> ranges;
+  for (size_t i = 0; i < posting->blocks.size(); i++) {
+    size_t first = posting->blocks[i];
+    while (i + 1 < posting->blocks.size() &&
+           posting->blocks[i + 1] == posting->blocks[i] + 1)
+      i++;
+    size_t last = posting->blocks[i] + 1;
+    ranges.push_back(RangeStorage(
+        blocks[first], last < blocks.size() ? blocks[last] : std::string()));
+  }
+
+  const std::uint64_t mirrored = mirrored_material(material);
+  const MinPlyType min_ply_type = get_min_ply_type(cdb);
+  std::atomic<size_t> next_range(0);
+  std::atomic<bool> stop(false);
+
+  auto work = [&]() {
+    const Comparator *cmp = cdb->db->GetOptions().comparator;
+    std::unique_ptr<Iterator> it(cdb->db->NewIterator(cdb->scan_read_options));
+    std::string fen;
+
+    for (size_t r = next_range++; r < ranges.size() && !stop; r = next_range++)
+      for (it->Seek(ranges[r].start);
+           it->Valid() && (ranges[r].limit.empty() ||
+                           cmp->Compare(it->key(), ranges[r].limit) < 0);
+           it->Next()) {
+
+        // other signatures in the same blocks are skipped before decoding
+        // their values
+        KeyPosition pos;
+        STM key_stm = decode_key(it->key(), pos), fen_stm = STM::NONE;
+        std::uint64_t entry_material = position_material(pos);
+        if (entry_material != material && entry_material != mirrored)
+          continue;
+
+        auto scored =
+            value_to_scoredMoves(it->value(), key_stm, fen_stm, min_ply_type);
+        key_position_to_fen(pos, key_stm, fen_stm, fen);
+        if (!evaluate_entry(fen, scored)) {
+          stop = true;
+          break;
+        }
+      }
+  };
+
+  const size_t num_nodes = cdb->numa ? numa_topology().size() : 1;
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < std::min(num_threads, ranges.size()); t++)
+    workers.emplace_back([&work, t, num_threads, num_nodes]() {
+      if (num_nodes > 1)
+        numa_pin_thread(t * num_nodes / num_threads);
+      work();
+    });
+  for (auto &t : workers)
+    t.join();
+
+  return true;
+}
+
+//
+// Compare two dumps, e.g. of different generations, with parallel merge joins
+// over matching key ranges. The function receives the kind of difference, the
+// fen, and the scored moves of the older and the newer dump (signalling a
+// failed probe for added and removed entries), and can return false to stop
+// early. With compare_min_ply == false, entries with different min_ply only
+// are not reported as changed. Of dumps with different min_ply encoding
+// schemes, only the min_ply of either orientation of a position is compared.
+//
+void cdbdirect_diff(
+    std::uintptr_t handle_old, std::uintptr_t handle_new, size_t num_threads,
+    bool compare_min_ply,
+    const std::function<bool(CDBDiff, const std::string &,
+                             const std::vector<std::pair<std::string, int>> &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &report) {
+
+  CDB *cdb_old = reinterpret_cast<CDB *>(handle_old);
+  CDB *cdb_new = reinterpret_cast<CDB *>(handle_new);
+
+  if (compare_min_ply && get_min_ply_type(cdb_old) != get_min_ply_type(cdb_new))
+    std::cerr << "The dumps encode min_ply differently, comparing the min_ply "
+                 "of either orientation only."
+              << std::endl;
+
+  // the ranges of the newer dump, open ended to cover all keys of the older
+  auto ranges = BuildRanges(cdb_new, num_threads);
+  ranges.front().start.clear();
+  ranges.back().limit.clear();
+
+  RunOnRanges(cdb_new, ranges, [&](const RangeStorage &range) {
+    DiffRange(cdb_old, cdb_new, range, compare_min_ply, report);
+  });
+}
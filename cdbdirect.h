@@ -6,13 +6,247 @@
 #include <utility>
 #include <vector>
 
+// how the table data is read: from a memory mapping, with pread, or with
+// pread and O_DIRECT into an own cache
+enum class CDBIOMode { AUTO, MMAP, PREAD, DIRECT };
+
+struct CDBOpenOptions {
+  // AUTO uses the mode selected by an earlier calibration, or else DIRECT
+  CDBIOMode io_mode = CDBIOMode::AUTO;
+  // time all modes on the dump, open with the fastest, and remember it
+  bool calibrate = false;
+  // -1 loads all table files during the open, with max_file_opening_threads
+  // threads (0: one per hardware thread). A positive value loads them on first
+  // access instead, keeping at most that many open, for a fast open of large
+  // dumps and no need for a large `ulimit -n`
+  int max_open_files = -1;
+  int max_file_opening_threads = 0;
+  // detect the min_ply encoding scheme with the first probe, not during open
+  bool lazy_min_ply = false;
+  // scans (cdbdirect_apply and friends, and the builds of the sidecar files)
+  // read past the block cache, so as not to evict the data of probes, and read
+  // ahead scan_readahead_size bytes of the table files (0: adaptive readahead)
+  bool scan_fill_cache = false;
+  size_t scan_readahead_size = 2 * 1024 * 1024;
+  // a dump that can not be opened ends the process, or, if false, makes
+  // cdbdirect_initialize return 0 (the error is printed to cerr either way)
+  bool exit_on_error = true;
+};
+
+// the handles of the same dump share one DB, and all handles of the process
+// share the block cache and the cache of table data read with O_DIRECT, of at
+// most the given sizes (by default 32 GB and 1 GB), which can only be changed
+// while no dump is open
+bool cdbdirect_set_cache_budget(std::uint64_t block_cache_bytes,
+                                std::uint64_t table_cache_bytes);
 std::uintptr_t cdbdirect_initialize(const std::string &path);
+std::uintptr_t cdbdirect_initialize(const std::string &path,
+                                    const CDBOpenOptions &options);
+std::string cdbdirect_io_mode(std::uintptr_t handle);
+std::vector<std::pair<std::string, double>>
+cdbdirect_open_timings(std::uintptr_t handle);
 std::uint64_t cdbdirect_size(std::uintptr_t handle);
+void cdbdirect_set_numa(std::uintptr_t handle, bool enabled);
+size_t cdbdirect_numa_nodes();
+size_t cdbdirect_numa_node();
+bool cdbdirect_numa_pin(size_t node);
 std::uintptr_t cdbdirect_finalize(std::uintptr_t handle);
+
+// the time and number of calls per stage of the probe and scan pipelines,
+// summed over all threads, empty unless built with CDB_PROFILE (make PROFILE=1)
+struct CDBStageProfile {
+  std::string stage;
+  double seconds;
+  std::uint64_t calls;
+};
+std::vector<CDBStageProfile> cdbdirect_profile();
+void cdbdirect_profile_reset();
 std::vector<std::pair<std::string, int>> cdbdirect_get(std::uintptr_t handle,
                                                        const std::string &fen);
+
+// the legal moves of a position, each with the fen after the move (in the
+// strict X-FEN of the DB keys) and its probe result as from cdbdirect_get, all
+// looked up in one batch; empty for an invalid fen or without legal moves
+struct CDBChild {
+  std::string move;
+  std::string fen;
+  std::vector<std::pair<std::string, int>> scored;
+};
+std::vector<CDBChild> cdbdirect_get_children(std::uintptr_t handle,
+                                             const std::string &fen);
+
+// scoped access to the raw value bytes (int16 encoded move and int16 score per
+// move, see decode_move() in fen2cdb.h), only valid during the call of use
+bool cdbdirect_get_raw(
+    std::uintptr_t handle, const std::string &fen,
+    const std::function<void(const char *, size_t, bool)> &use);
+
+// the best moves of a position, as returned by cdbdirect_get_best()
+const size_t CDB_MAX_BEST = 8;
+struct CDBMove {
+  char uci[6];
+  int score;
+};
+struct CDBBest {
+  int min_ply;        // -2 (not in DB), -1 (unknown), or distance to startpos
+  size_t num_moves;   // number of moves below, sorted by score
+  size_t total_moves; // number of scored moves of the position
+  CDBMove moves[CDB_MAX_BEST];
+};
+CDBBest cdbdirect_get_best(std::uintptr_t handle, const std::string &fen,
+                           size_t k);
+// as cdbdirect_get_best, for the best (at most) capacity moves, written to the
+// caller's array, returning min_ply
+int cdbdirect_get_best(std::uintptr_t handle, const std::string &fen,
+                       CDBMove *moves, size_t capacity, size_t &num_moves,
+                       size_t &total_moves);
+// as above, for a batch of positions looked up together: the moves of fens[i]
+// are written to the caller's array moves_of(i), their number to
+// num_moves[i], and the min_ply of each position is returned
+std::vector<int>
+cdbdirect_get_best_batch(std::uintptr_t handle,
+                         const std::vector<std::string> &fens,
+                         const std::function<CDBMove *(size_t)> &moves_of,
+                         size_t capacity, std::vector<size_t> &num_moves);
+
 void cdbdirect_apply(
     std::uintptr_t handle, size_t num_threads,
     const std::function<bool(const std::string &,
                              const std::vector<std::pair<std::string, int>> &)>
         &evaluate_entry);
+
+// a range of DB keys, from start up to (excluding) limit, where an empty key
+// leaves that side open. cdbdirect_shard() splits the DB into num_shards
+// disjoint ranges (shard counting from 0), the same for all copies of a dump,
+// to split a scan over several processes or machines.
+struct CDBKeyRange {
+  std::string start;
+  std::string limit;
+};
+CDBKeyRange cdbdirect_shard(std::uintptr_t handle, size_t shard,
+                            size_t num_shards);
+void cdbdirect_apply_range(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const CDBKeyRange &key_range);
+
+// a census of the keys only, e.g. to count entries exactly or by material or
+// side to move: evaluate_key gets the fen of each entry, in the orientation of
+// its key, and the values are not read. Returns the number of keys scanned,
+// which without evaluate_key (nullptr) is an exact count of the entries.
+std::uint64_t cdbdirect_apply_keys(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &)> &evaluate_key,
+    const CDBKeyRange &key_range = CDBKeyRange());
+
+// as cdbdirect_apply, but calling evaluate_entry in key order, from the calling
+// thread, while the entries are read and decoded ahead by num_threads threads,
+// optionally from the key of the fen start up to (excluding) the key of stop
+void cdbdirect_apply_ordered(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const std::string &start = "", const std::string &stop = "");
+
+// scan the positions whose leading ranks, from rank 8, are the given ones, as
+// in a fen (e.g. "r3k2r" or "rnbqkbnr/pppppppp"), which are adjacent in key
+// order, without a full scan. Positions are matched in the orientation of
+// their key (the position or its BW mirror, whichever has the smaller hexfen),
+// and evaluate_entry gets the fen in that orientation. False if the ranks are
+// invalid.
+bool cdbdirect_scan_prefix(
+    std::uintptr_t handle, size_t num_threads, const std::string &ranks,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry);
+
+// periodic checkpoints of a scan, from which an interrupted scan resumes: the
+// position in each range, and the state of the caller as serialized by save()
+// and restored by load()
+struct CDBCheckpoint {
+  std::string filename;
+  double interval = 60; // seconds
+  std::function<std::string()> save;
+  std::function<void(const std::string &)> load;
+};
+// the end of a scan with checkpoints: all entries done, stopped by the caller
+// with a checkpoint to resume from, or stopped without (as writing the
+// checkpoint failed, or the checkpoint is not of this dump and key range)
+enum class CDBScanStatus { COMPLETED, STOPPED, FAILED };
+CDBScanStatus cdbdirect_apply(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const CDBCheckpoint &checkpoint);
+CDBScanStatus cdbdirect_apply_range(
+    std::uintptr_t handle, size_t num_threads,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry,
+    const CDBKeyRange &key_range, const CDBCheckpoint &checkpoint);
+
+// filters are only loaded for the dump they were built of. A filter of all keys
+// is by default written next to the dump, a filter of the keys selected by
+// select needs a filename, and is not picked up by cdbdirect_initialize.
+bool cdbdirect_load_filter(std::uintptr_t handle, const std::string &filename);
+bool cdbdirect_build_filter(
+    std::uintptr_t handle, size_t num_threads, const std::string &filename = "",
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &select = nullptr);
+bool cdbdirect_load_snapshot(std::uintptr_t handle,
+                             const std::string &filename);
+bool cdbdirect_build_snapshot(
+    std::uintptr_t handle, size_t num_threads, const std::string &filename,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &select);
+bool cdbdirect_build_snapshot(std::uintptr_t handle,
+                              const std::vector<std::string> &fens,
+                              const std::string &filename = "");
+
+// the manifest of the key ranges, with exact entry counts and sizes, which is
+// used by cdbdirect_apply and cdbdirect_size, and only loaded for the dump it
+// was built of. The keys of ranges given by index are scanned with
+// cdbdirect_apply_range, e.g. range i with cdbdirect_ranges()[i].key_range.
+struct CDBRange {
+  std::uint64_t keys;
+  std::uint64_t bytes;
+  CDBKeyRange key_range;
+};
+bool cdbdirect_load_manifest(std::uintptr_t handle,
+                             const std::string &filename);
+bool cdbdirect_build_manifest(std::uintptr_t handle, size_t num_threads,
+                              const std::string &filename = "",
+                              size_t keys_per_range = 1000000);
+std::vector<CDBRange> cdbdirect_ranges(std::uintptr_t handle);
+CDBKeyRange cdbdirect_manifest_range(std::uintptr_t handle, size_t first,
+                                     size_t last);
+
+// the index of the material signatures of the entries with few pieces, which
+// allows to scan an endgame class, e.g. "KRPvKR" (for both colour
+// assignments), reading only the blocks of keys with entries of this class
+bool cdbdirect_load_material(std::uintptr_t handle,
+                             const std::string &filename);
+bool cdbdirect_build_material(std::uintptr_t handle, size_t num_threads,
+                              const std::string &filename = "",
+                              size_t max_pieces = 7,
+                              size_t keys_per_block = 16384);
+bool cdbdirect_apply_material(
+    std::uintptr_t handle, size_t num_threads, const std::string &signature,
+    const std::function<bool(const std::string &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &evaluate_entry);
+
+enum class CDBDiff { ADDED, REMOVED, CHANGED };
+void cdbdirect_diff(
+    std::uintptr_t handle_old, std::uintptr_t handle_new, size_t num_threads,
+    bool compare_min_ply,
+    const std::function<bool(CDBDiff, const std::string &,
+                             const std::vector<std::pair<std::string, int>> &,
+                             const std::vector<std::pair<std::string, int>> &)>
+        &report);
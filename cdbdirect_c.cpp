@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cdbdirect.h"
+#include "cdbdirect_c.h"
+#include "fen2cdb.h"
+
+// the moves of cdb_result_t are written by cdbdirect_get_best as CDBMove
+static_assert(sizeof(cdb_move_t) == sizeof(CDBMove) &&
+                  offsetof(cdb_move_t, uci) == offsetof(CDBMove, uci) &&
+                  offsetof(cdb_move_t, score) == offsetof(CDBMove, score) &&
+                  sizeof(int32_t) == sizeof(int),
+              "cdb_move_t and CDBMove differ");
+
+namespace {
+
+// copy a string into a fixed size, NUL terminated field
+template <size_t N> void copy_field(char (&field)[N], const std::string &s) {
+  size_t n = std::min(s.size(), N - 1);
+  std::memcpy(field, s.data(), n);
+  field[n] = '\0';
+}
+
+void invalid_result(cdb_result_t *result) {
+  result->min_ply = CDB_C_INVALID;
+  result->num_moves = 0;
+}
+
+} // namespace
+
+// no C++ exception (e.g. std::bad_alloc) may reach the C callers, each call
+// catches them and returns its error value
+extern "C" {
+
+uintptr_t cdb_open(const char *path) {
+  try {
+    CDBOpenOptions options;
+    options.exit_on_error = false;
+    return cdbdirect_initialize(path, options);
+  } catch (...) {
+    return 0;
+  }
+}
+
+void cdb_close(uintptr_t handle) {
+  try {
+    cdbdirect_finalize(handle);
+  } catch (...) {
+  }
+}
+
+int cdb_stats(uintptr_t handle, cdb_stats_t *stats) {
+  try {
+    stats->entries = cdbdirect_size(handle);
+    stats->open_seconds = 0;
+    for (auto &phase : cdbdirect_open_timings(handle))
+      stats->open_seconds += phase.second;
+    copy_field(stats->io_mode, cdbdirect_io_mode(handle));
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+size_t cdb_profile(cdb_stage_t *stages, size_t capacity) {
+  try {
+    auto profile = cdbdirect_profile();
+    for (size_t i = 0; i < profile.size() && i < capacity; i++) {
+      copy_field(stages[i].stage, profile[i].stage);
+      stages[i].seconds = profile[i].seconds;
+      stages[i].calls = profile[i].calls;
+    }
+    return profile.size();
+  } catch (...) {
+    return 0;
+  }
+}
+
+// all moves, selected straight into the caller's result
+int32_t cdb_get(uintptr_t handle, const char *fen, cdb_result_t *result) {
+  try {
+    if (!cbfen_valid(fen)) {
+      invalid_result(result);
+      return result->min_ply;
+    }
+    size_t num_moves, total_moves;
+    result->min_ply = cdbdirect_get_best(
+        handle, fen, reinterpret_cast<CDBMove *>(result->moves),
+        CDB_C_MAX_MOVES, num_moves, total_moves);
+    result->num_moves = num_moves;
+  } catch (...) {
+    invalid_result(result);
+  }
+  return result->min_ply;
+}
+
+// all moves of a batch, looked up together and selected into the results
+size_t cdb_get_batch(uintptr_t handle, const char *const *fens, size_t count,
+                     cdb_result_t *results) {
+  try {
+    // the valid fens only are probed
+    std::vector<std::string> batch;
+    std::vector<size_t> index;
+    for (size_t i = 0; i < count; i++)
+      if (cbfen_valid(fens[i])) {
+        batch.push_back(fens[i]);
+        index.push_back(i);
+      } else
+        invalid_result(&results[i]);
+
+    std::vector<size_t> num_moves;
+    auto min_plies = cdbdirect_get_best_batch(
+        handle, batch,
+        [&](size_t j) {
+          return reinterpret_cast<CDBMove *>(results[index[j]].moves);
+        },
+        CDB_C_MAX_MOVES, num_moves);
+    size_t found = 0;
+    for (size_t j = 0; j < batch.size(); j++) {
+      results[index[j]].min_ply = min_plies[j];
+      results[index[j]].num_moves = num_moves[j];
+      if (min_plies[j] > -2)
+        found++;
+    }
+    return found;
+  } catch (...) {
+    for (size_t i = 0; i < count; i++)
+      invalid_result(&results[i]);
+    return 0;
+  }
+}
+
+int cdb_apply(uintptr_t handle, size_t num_threads, cdb_entry_fn evaluate,
+              void *user) {
+  try {
+    cdbdirect_apply(
+        handle, num_threads,
+        [evaluate, user](
+            const std::string &fen,
+            const std::vector<std::pair<std::string, int>> &scored) {
+          // one result per thread, reused for all its entries
+          thread_local cdb_result_t result;
+          result.min_ply = scored.back().second;
+          result.num_moves = 0;
+          for (size_t i = 0; i + 1 < scored.size() && i < CDB_C_MAX_MOVES;
+               i++) {
+            copy_field(result.moves[i].uci, scored[i].first);
+            result.moves[i].score = scored[i].second;
+            result.num_moves++;
+          }
+          return evaluate(user, fen.c_str(), &result) != 0;
+        });
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+}
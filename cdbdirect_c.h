@@ -0,0 +1,87 @@
+#ifndef CDBDIRECT_C_H
+#define CDBDIRECT_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// A C interface to the library, for bindings of other languages (e.g. Rust or
+// Go) and for libcdbdirect.so. All results are written to structs and arrays
+// owned by the caller, nothing is allocated for the caller, and the strings
+// passed in are only read during the call. The handles are those of
+// cdbdirect.h. No call ends the process or lets a C++ exception pass, errors
+// are returned, and only these functions are exported by libcdbdirect.so.
+//
+
+#if defined(__GNUC__)
+#define CDB_C_API __attribute__((visibility("default")))
+#else
+#define CDB_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// more than the number of legal moves of any position
+#define CDB_C_MAX_MOVES 256
+
+typedef struct {
+  char uci[6]; // NUL terminated
+  int32_t score;
+} cdb_move_t;
+
+// the min_ply of an invalid fen, or of a probe that failed
+#define CDB_C_INVALID (-3)
+
+// the probe result of a position, as cdbdirect_get: the scored moves sorted by
+// score, and min_ply CDB_C_INVALID, -2 (not in DB), -1 (unknown), or the
+// distance to startpos
+typedef struct {
+  int32_t min_ply;
+  uint32_t num_moves;
+  cdb_move_t moves[CDB_C_MAX_MOVES];
+} cdb_result_t;
+
+typedef struct {
+  uint64_t entries;    // as cdbdirect_size
+  double open_seconds; // the time of the open, all phases
+  char io_mode[8];     // NUL terminated
+} cdb_stats_t;
+
+typedef struct {
+  char stage[32]; // NUL terminated
+  double seconds;
+  uint64_t calls;
+} cdb_stage_t;
+
+// the handle of the dump at path, 0 if it can not be opened
+CDB_C_API uintptr_t cdb_open(const char *path);
+CDB_C_API void cdb_close(uintptr_t handle);
+// returns 0 on an error
+CDB_C_API int cdb_stats(uintptr_t handle, cdb_stats_t *stats);
+
+// the stages of cdbdirect_profile, at most capacity, returning their number
+CDB_C_API size_t cdb_profile(cdb_stage_t *stages, size_t capacity);
+
+// the min_ply of the position, with its moves in result
+CDB_C_API int32_t cdb_get(uintptr_t handle, const char *fen,
+                          cdb_result_t *result);
+
+// probe count positions into results[0 .. count), returning the number found
+CDB_C_API size_t cdb_get_batch(uintptr_t handle, const char *const *fens,
+                               size_t count, cdb_result_t *results);
+
+// called for all entries by cdb_apply, from several threads at once, with the
+// user pointer of the call. The fen and result are only valid during the call.
+// Returning 0 stops the scan. cdb_apply returns 0 on an error.
+typedef int (*cdb_entry_fn)(void *user, const char *fen,
+                            const cdb_result_t *result);
+CDB_C_API int cdb_apply(uintptr_t handle, size_t num_threads,
+                        cdb_entry_fn evaluate, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
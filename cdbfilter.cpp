@@ -0,0 +1,384 @@
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "cdbfilter.h"
+
+namespace {
+
+const char filter_magic[8] = {'C', 'D', 'B', 'X', 'O', 'R', '8', '\0'};
+const std::uint32_t filter_version = 2;
+
+// keys per partition, partitions per temporary file (bucket) used during the
+// build, and the bytes each Sink buffers over all buckets
+const std::uint64_t keys_per_partition = 1ULL << 22;
+const std::uint32_t partitions_per_bucket = 4;
+const std::size_t sink_buffer_bytes = 16 * 1024 * 1024;
+
+std::uint64_t rotl64(std::uint64_t n, unsigned int c) {
+  return (n << (c & 63)) | (n >> ((-c) & 63));
+}
+
+std::uint32_t reduce(std::uint32_t hash, std::uint32_t n) {
+  return (std::uint32_t)(((std::uint64_t)hash * n) >> 32);
+}
+
+std::uint8_t fingerprint(std::uint64_t hash) {
+  return (std::uint8_t)(hash ^ (hash >> 32));
+}
+
+std::uint64_t block_length_for(std::uint64_t count) {
+  if (count == 0)
+    return 0;
+  return (32 + (std::uint64_t)std::ceil(1.23 * count)) / 3;
+}
+
+// the three locations of a (seeded) hash in the fingerprint array
+void locations(std::uint64_t hash, std::uint64_t block_length,
+               std::uint64_t h[3]) {
+  for (int i = 0; i < 3; i++)
+    h[i] = reduce((std::uint32_t)rotl64(hash, 21 * i), block_length) +
+           i * block_length;
+}
+
+//
+// construct the fingerprints of one partition from its sorted, unique hashes,
+// returns the seed that succeeded
+//
+std::uint64_t build_partition(const std::uint64_t *hashes, std::size_t n,
+                              std::uint64_t block_length,
+                              std::uint64_t seed_state,
+                              std::vector<std::uint8_t> &fingerprints) {
+
+  const std::uint64_t capacity = 3 * block_length;
+  std::vector<std::uint64_t> xormask(capacity);
+  std::vector<std::uint32_t> count(capacity);
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> queue, stack;
+  queue.reserve(capacity);
+  stack.reserve(n);
+
+  while (true) {
+    // splitmix64 for the next seed
+    seed_state += 0x9e3779b97f4a7c15ULL;
+    std::uint64_t seed = hash_mix(seed_state);
+
+    std::fill(xormask.begin(), xormask.end(), 0);
+    std::fill(count.begin(), count.end(), 0);
+    queue.clear();
+    stack.clear();
+
+    std::uint64_t h[3];
+    for (std::size_t i = 0; i < n; i++) {
+      std::uint64_t hash = hash_mix(hashes[i] + seed);
+      locations(hash, block_length, h);
+      for (int j = 0; j < 3; j++) {
+        xormask[h[j]] ^= hash;
+        count[h[j]]++;
+      }
+    }
+
+    // peel the hypergraph, locations with a single key are removed first
+    for (std::uint64_t i = 0; i < capacity; i++)
+      if (count[i] == 1)
+        queue.push_back({i, xormask[i]});
+
+    while (!queue.empty()) {
+      auto [index, hash] = queue.back();
+      queue.pop_back();
+      if (count[index] != 1)
+        continue;
+      stack.push_back({index, hash});
+      locations(hash, block_length, h);
+      for (int j = 0; j < 3; j++) {
+        xormask[h[j]] ^= hash;
+        if (--count[h[j]] == 1)
+          queue.push_back({h[j], xormask[h[j]]});
+      }
+    }
+
+    if (stack.size() != n)
+      continue; // the hypergraph has a cycle, retry with another seed
+
+    // assign in reverse peeling order
+    fingerprints.assign(capacity, 0);
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+      locations(it->second, block_length, h);
+      fingerprints[it->first] = 0;
+      fingerprints[it->first] = fingerprint(it->second) ^ fingerprints[h[0]] ^
+                                fingerprints[h[1]] ^ fingerprints[h[2]];
+    }
+
+    return seed;
+  }
+}
+
+} // namespace
+
+bool XorFilter::open(const std::string &filename) {
+
+  if (!m_file.open(filename))
+    return false;
+
+  if (m_file.size() < sizeof(XorFilterHeader))
+    return false;
+
+  m_header = reinterpret_cast<const XorFilterHeader *>(m_file.data());
+  m_partitions = reinterpret_cast<const XorFilterPartition *>(
+      m_file.data() + sizeof(XorFilterHeader));
+
+  if (std::memcmp(m_header->magic, filter_magic, sizeof(filter_magic)) ||
+      m_header->version != filter_version || m_header->num_partitions == 0 ||
+      m_file.size() < sizeof(XorFilterHeader) + m_header->num_partitions *
+                                                     sizeof(XorFilterPartition)) {
+    std::cerr << "Invalid filter file " << filename << std::endl;
+    m_file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool XorFilter::contain(std::uint64_t hash) const {
+
+  std::uint32_t p =
+      (std::uint32_t)(((hash >> 32) * m_header->num_partitions) >> 32);
+  const XorFilterPartition &part = m_partitions[p];
+  if (part.block_length == 0)
+    return false;
+
+  std::uint64_t h[3];
+  hash = hash_mix(hash + part.seed);
+  locations(hash, part.block_length, h);
+  const std::uint8_t *fp =
+      reinterpret_cast<const std::uint8_t *>(m_file.data() + part.offset);
+  return fingerprint(hash) == (fp[h[0]] ^ fp[h[1]] ^ fp[h[2]]);
+}
+
+XorFilterBuilder::XorFilterBuilder(const std::string &filename,
+                                   std::uint64_t expected_keys,
+                                   std::uint64_t dump_id, bool subset)
+    : m_filename(filename), m_dump_id(dump_id), m_subset(subset) {
+
+  m_num_partitions = std::max<std::uint64_t>(
+      1, (expected_keys + keys_per_partition - 1) / keys_per_partition);
+  m_num_buckets =
+      (m_num_partitions + partitions_per_bucket - 1) / partitions_per_bucket;
+  m_spill_size = std::clamp<std::size_t>(
+      sink_buffer_bytes / sizeof(std::uint64_t) / m_num_buckets, 512, 8192);
+  m_counts.reset(new std::atomic<std::uint64_t>[m_num_partitions]);
+  for (std::uint32_t p = 0; p < m_num_partitions; p++)
+    m_counts[p] = 0;
+
+  // the buckets of a large DB are a few thousand open files
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < m_num_buckets + 1024 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = std::min<rlim_t>(m_num_buckets + 1024, limit.rlim_max);
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  m_bucket_mutexes.reset(new std::mutex[m_num_buckets]);
+  for (std::uint32_t b = 0; b < m_num_buckets; b++) {
+    std::FILE *f = std::fopen(bucket_filename(b).c_str(), "w+b");
+    if (!f) {
+      std::cerr << "Unable to create temporary file " << bucket_filename(b)
+                << " (" << m_num_buckets << " are needed, see ulimit -n)"
+                << std::endl;
+      std::exit(1);
+    }
+    m_bucket_files.push_back(f);
+  }
+}
+
+XorFilterBuilder::~XorFilterBuilder() {
+  for (std::uint32_t b = 0; b < m_bucket_files.size(); b++) {
+    std::fclose(m_bucket_files[b]);
+    std::remove(bucket_filename(b).c_str());
+  }
+}
+
+std::string XorFilterBuilder::bucket_filename(std::uint32_t bucket) const {
+  return m_filename + ".tmp." + std::to_string(bucket);
+}
+
+std::uint32_t XorFilterBuilder::partition_of(std::uint64_t hash) const {
+  return (std::uint32_t)(((hash >> 32) * m_num_partitions) >> 32);
+}
+
+std::uint32_t XorFilterBuilder::bucket_of(std::uint32_t partition) const {
+  return partition / partitions_per_bucket;
+}
+
+void XorFilterBuilder::spill(std::uint32_t bucket,
+                             const std::vector<std::uint64_t> &hashes) {
+  for (auto hash : hashes)
+    m_counts[partition_of(hash)].fetch_add(1, std::memory_order_relaxed);
+
+  const std::lock_guard<std::mutex> lock(m_bucket_mutexes[bucket]);
+  if (std::fwrite(hashes.data(), sizeof(std::uint64_t), hashes.size(),
+                  m_bucket_files[bucket]) != hashes.size())
+    m_spill_failed = true;
+}
+
+XorFilterBuilder::Sink::Sink(XorFilterBuilder &builder)
+    : m_builder(builder), m_buffers(builder.m_num_buckets) {}
+
+void XorFilterBuilder::Sink::add(std::uint64_t hash) {
+  auto bucket = m_builder.bucket_of(m_builder.partition_of(hash));
+  auto &buffer = m_buffers[bucket];
+  buffer.push_back(hash);
+  if (buffer.size() >= m_builder.m_spill_size) {
+    m_builder.spill(bucket, buffer);
+    buffer.clear();
+  }
+}
+
+void XorFilterBuilder::Sink::flush() {
+  for (std::uint32_t b = 0; b < m_buffers.size(); b++) {
+    if (!m_buffers[b].empty())
+      m_builder.spill(b, m_buffers[b]);
+    m_buffers[b].clear();
+  }
+}
+
+bool XorFilterBuilder::finish(std::size_t num_threads,
+                              std::uint64_t memory_budget) {
+
+  for (std::uint32_t b = 0; b < m_num_buckets; b++)
+    if (std::fflush(m_bucket_files[b]) != 0)
+      m_spill_failed = true;
+  if (m_spill_failed) {
+    std::cerr << "Failed to write the temporary files of " << m_filename
+              << ", is the disk full?" << std::endl;
+    return false;
+  }
+
+  // the layout of the file follows from the number of hashes per partition
+  std::vector<XorFilterPartition> partitions(m_num_partitions);
+  std::uint64_t offset = sizeof(XorFilterHeader) +
+                         m_num_partitions * sizeof(XorFilterPartition);
+  std::uint64_t num_keys = 0;
+  for (std::uint32_t p = 0; p < m_num_partitions; p++) {
+    partitions[p].block_length = block_length_for(m_counts[p]);
+    partitions[p].offset = offset;
+    offset += 3 * partitions[p].block_length;
+    num_keys += m_counts[p];
+  }
+
+  // written under a temporary name and renamed when complete, so that
+  // processes still mapping an older filter are not affected
+  const std::string part_filename = m_filename + ".part";
+  int fd = ::open(part_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "Unable to create filter file " << part_filename << std::endl;
+    return false;
+  }
+
+  // a worker holds the hashes of a bucket, and the tables of one partition,
+  // about 52 bytes per hash, so the largest bucket bounds the number of
+  // workers within the memory budget
+  std::uint64_t max_bucket_bytes = 0;
+  for (std::uint32_t b = 0; b < m_num_buckets; b++) {
+    std::uint64_t bucket_bytes = 0, partition_bytes = 0;
+    for (std::uint32_t p = b * partitions_per_bucket;
+         p < std::min(m_num_partitions, (b + 1) * partitions_per_bucket); p++) {
+      bucket_bytes += m_counts[p] * sizeof(std::uint64_t);
+      partition_bytes = std::max<std::uint64_t>(partition_bytes,
+                                                52 * m_counts[p]);
+    }
+    max_bucket_bytes =
+        std::max(max_bucket_bytes, bucket_bytes + partition_bytes);
+  }
+  num_threads = std::clamp<std::uint64_t>(
+      memory_budget / std::max<std::uint64_t>(max_bucket_bytes, 1), 1,
+      std::max<std::size_t>(num_threads, 1));
+
+  // construct the partitions, one bucket of partitions at a time per thread
+  std::atomic<std::uint32_t> next_bucket(0);
+  std::atomic<bool> ok(true);
+  auto worker = [&]() {
+    std::vector<std::uint64_t> hashes;
+    std::vector<std::uint8_t> fingerprints;
+    for (std::uint32_t b = next_bucket++; b < m_num_buckets;
+         b = next_bucket++) {
+
+      std::FILE *f = m_bucket_files[b];
+      long bytes = std::ftell(f);
+      if (bytes < 0) {
+        ok = false;
+        return;
+      }
+      hashes.resize(bytes / sizeof(std::uint64_t));
+      std::rewind(f);
+      if (std::fread(hashes.data(), sizeof(std::uint64_t), hashes.size(), f) !=
+          hashes.size()) {
+        ok = false;
+        return;
+      }
+
+      // partitions are ordered by hash, so sorting groups them
+      std::sort(hashes.begin(), hashes.end());
+      hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+      auto first = hashes.begin();
+      while (first != hashes.end()) {
+        std::uint32_t p = partition_of(*first);
+        auto last = std::find_if(first, hashes.end(), [&](std::uint64_t h) {
+          return partition_of(h) != p;
+        });
+        auto &part = partitions[p];
+        part.seed = build_partition(&*first, last - first, part.block_length,
+                                    p, fingerprints);
+        if (pwrite(fd, fingerprints.data(), fingerprints.size(),
+                   part.offset) != (ssize_t)fingerprints.size())
+          ok = false;
+        first = last;
+      }
+      hashes = std::vector<std::uint64_t>();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t t = 0; t < num_threads; t++)
+    workers.emplace_back(worker);
+  for (auto &t : workers)
+    t.join();
+
+  XorFilterHeader header;
+  std::memcpy(header.magic, filter_magic, sizeof(filter_magic));
+  header.version = filter_version;
+  header.num_partitions = m_num_partitions;
+  header.num_keys = num_keys;
+  header.dump_id = m_dump_id;
+  header.subset = m_subset;
+  header.reserved = 0;
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      pwrite(fd, partitions.data(),
+             partitions.size() * sizeof(XorFilterPartition),
+             sizeof(header)) !=
+          (ssize_t)(partitions.size() * sizeof(XorFilterPartition)))
+    ok = false;
+
+  // make sure the file has its full size, even if the last partitions are
+  // empty
+  if (ftruncate(fd, offset) != 0)
+    ok = false;
+  ::close(fd);
+
+  if (ok && std::rename(part_filename.c_str(), m_filename.c_str()) != 0)
+    ok = false;
+
+  if (!ok) {
+    std::cerr << "Failed to write filter file " << m_filename << std::endl;
+    std::remove(part_filename.c_str());
+  }
+
+  return ok;
+}
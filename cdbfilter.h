@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cdbsidecar.h"
+
+//
+// A partitioned xor filter with 8 bit fingerprints (about 9.9 bits per key, and
+// about 0.4% false positives), see Graf & Lemire, "Xor Filters: Faster and
+// Smaller Than Bloom and Cuckoo Filters". The keys are split by hash into
+// partitions of a few million keys each, so that even a filter of all keys of
+// the DB can be built with bounded memory.
+//
+// On disk, a filter is a header, a table of partitions, and the fingerprints
+// of all partitions, it is used directly from a memory mapping. The header
+// records the dump the keys are of, and whether they are a subset of its keys.
+//
+struct XorFilterHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t num_partitions;
+  std::uint64_t num_keys;
+  std::uint64_t dump_id;
+  std::uint32_t subset;
+  std::uint32_t reserved;
+};
+
+struct XorFilterPartition {
+  std::uint64_t seed;
+  std::uint64_t offset; // of the fingerprints, in bytes from the file start
+  std::uint64_t block_length;
+};
+
+class XorFilter {
+public:
+  bool open(const std::string &filename);
+
+  // false if the key with the given hash_key() is certainly not in the filter
+  bool contain(std::uint64_t hash) const;
+
+  std::uint64_t num_keys() const { return m_header->num_keys; }
+  std::uint64_t dump_id() const { return m_header->dump_id; }
+  bool subset() const { return m_header->subset != 0; }
+  std::size_t size_bytes() const { return m_file.size(); }
+
+private:
+  MappedFile m_file;
+  const XorFilterHeader *m_header = nullptr;
+  const XorFilterPartition *m_partitions = nullptr;
+};
+
+//
+// Build a filter from the hashes of the keys, added concurrently via one Sink
+// per thread. The hashes are spilled to temporary files next to the filter,
+// one file (bucket) per group of a few partitions, and each partition is
+// constructed from them in finish(), with as many buckets in memory at a time
+// as fit in memory_budget bytes.
+//
+class XorFilterBuilder {
+public:
+  XorFilterBuilder(const std::string &filename, std::uint64_t expected_keys,
+                   std::uint64_t dump_id, bool subset);
+  ~XorFilterBuilder();
+
+  class Sink {
+  public:
+    explicit Sink(XorFilterBuilder &builder);
+    ~Sink() { flush(); }
+    void add(std::uint64_t hash);
+    void flush();
+
+  private:
+    XorFilterBuilder &m_builder;
+    std::vector<std::vector<std::uint64_t>> m_buffers;
+  };
+
+  // construct all partitions with num_threads threads, and write the filter
+  bool finish(std::size_t num_threads,
+              std::uint64_t memory_budget = 8ULL * 1024 * 1024 * 1024);
+
+private:
+  std::uint32_t partition_of(std::uint64_t hash) const;
+  std::uint32_t bucket_of(std::uint32_t partition) const;
+  void spill(std::uint32_t bucket, const std::vector<std::uint64_t> &hashes);
+  std::string bucket_filename(std::uint32_t bucket) const;
+
+  std::string m_filename;
+  std::uint64_t m_dump_id;
+  bool m_subset;
+  std::uint32_t m_num_partitions;
+  std::uint32_t m_num_buckets;
+  std::size_t m_spill_size; // hashes buffered per bucket by a Sink
+  std::unique_ptr<std::atomic<std::uint64_t>[]> m_counts; // per partition
+  std::vector<std::FILE *> m_bucket_files;
+  std::unique_ptr<std::mutex[]> m_bucket_mutexes;
+  std::atomic<bool> m_spill_failed{false};
+};
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "cdbmanifest.h"
+
+namespace {
+
+const char manifest_magic[8] = {'C', 'D', 'B', 'R', 'A', 'N', 'G', 'E'};
+const std::uint32_t manifest_version = 2;
+
+} // namespace
+
+bool RangeManifest::open(const std::string &filename) {
+
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  ManifestHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, manifest_magic, sizeof(manifest_magic)) ||
+      header.version != manifest_version) {
+    std::cerr << "Invalid manifest file " << filename << std::endl;
+    return false;
+  }
+
+  // per range: number of keys and bytes, the size of the start key and the key
+  std::vector<ManifestRange> ranges(header.num_ranges);
+  for (auto &range : ranges) {
+    std::uint32_t size = 0;
+    file.read(reinterpret_cast<char *>(&range.keys), sizeof(range.keys));
+    file.read(reinterpret_cast<char *>(&range.bytes), sizeof(range.bytes));
+    file.read(reinterpret_cast<char *>(&size), sizeof(size));
+    range.start.resize(size);
+    file.read(&range.start[0], size);
+  }
+  if (!file) {
+    std::cerr << "Truncated manifest file " << filename << std::endl;
+    return false;
+  }
+
+  m_ranges = std::move(ranges);
+  m_num_keys = header.num_keys;
+  m_num_bytes = header.num_bytes;
+  m_dump_id = header.dump_id;
+  return true;
+}
+
+std::vector<std::pair<std::string, std::string>>
+RangeManifest::partition(std::size_t num_parts, std::size_t first,
+                         std::size_t last) const {
+
+  std::vector<std::pair<std::string, std::string>> parts;
+  last = std::min(last, m_ranges.size());
+  if (first >= last || num_parts == 0)
+    return parts;
+
+  std::uint64_t keys = 0;
+  for (std::size_t i = first; i < last; i++)
+    keys += m_ranges[i].keys;
+  keys = std::max<std::uint64_t>(keys, 1);
+
+  // cut after the range that reaches the next multiple of keys / num_parts
+  std::uint64_t sum = 0;
+  std::size_t start = first;
+  for (std::size_t i = first; i < last; i++) {
+    sum += m_ranges[i].keys;
+    if (i + 1 == last || sum * num_parts >= (parts.size() + 1) * keys) {
+      parts.push_back({m_ranges[start].start,
+                       i + 1 < m_ranges.size() ? m_ranges[i + 1].start : ""});
+      start = i + 1;
+    }
+  }
+
+  return parts;
+}
+
+bool write_manifest(const std::string &filename, std::uint64_t dump_id,
+                    const std::vector<ManifestRange> &ranges) {
+
+  ManifestHeader header;
+  std::memcpy(header.magic, manifest_magic, sizeof(manifest_magic));
+  header.version = manifest_version;
+  header.reserved = 0;
+  header.num_ranges = ranges.size();
+  header.num_keys = 0;
+  header.num_bytes = 0;
+  header.dump_id = dump_id;
+  for (auto &range : ranges) {
+    header.num_keys += range.keys;
+    header.num_bytes += range.bytes;
+  }
+
+  // write to a temporary name, and rename when complete
+  const std::string part_filename = filename + ".part";
+  std::ofstream file(part_filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to create manifest file " << part_filename
+              << std::endl;
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (auto &range : ranges) {
+    std::uint32_t size = range.start.size();
+    file.write(reinterpret_cast<const char *>(&range.keys), sizeof(range.keys));
+    file.write(reinterpret_cast<const char *>(&range.bytes),
+               sizeof(range.bytes));
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    file.write(range.start.data(), size);
+  }
+  file.close();
+
+  if (!file || std::rename(part_filename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Failed to write manifest file " << filename << std::endl;
+    std::remove(part_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
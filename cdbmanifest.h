@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// A manifest of the key ranges of a dump, with the exact number of entries and
+// bytes (of keys and values) of each range. As a dump is immutable, it is
+// computed once, and allows for balanced partitioning of scans, exact counts
+// and progress, and addressing ranges by index.
+//
+// The ranges are consecutive: range i covers the keys from its start key up to
+// (excluding) the start key of range i + 1, the last range is open ended. The
+// manifest records the identity of its dump, as it is only valid for that.
+//
+struct ManifestHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint64_t num_ranges;
+  std::uint64_t num_keys;
+  std::uint64_t num_bytes;
+  std::uint64_t dump_id;
+};
+
+struct ManifestRange {
+  std::string start;
+  std::uint64_t keys = 0;
+  std::uint64_t bytes = 0;
+};
+
+class RangeManifest {
+public:
+  bool open(const std::string &filename);
+
+  const std::vector<ManifestRange> &ranges() const { return m_ranges; }
+  std::uint64_t num_keys() const { return m_num_keys; }
+  std::uint64_t num_bytes() const { return m_num_bytes; }
+  std::uint64_t dump_id() const { return m_dump_id; }
+
+  // split the ranges first to last (excluding) into at most num_parts parts
+  // with about the same number of keys, as start and limit keys, an empty
+  // limit being open ended
+  std::vector<std::pair<std::string, std::string>>
+  partition(std::size_t num_parts, std::size_t first, std::size_t last) const;
+
+private:
+  std::vector<ManifestRange> m_ranges;
+  std::uint64_t m_num_keys = 0;
+  std::uint64_t m_num_bytes = 0;
+  std::uint64_t m_dump_id = 0;
+};
+
+bool write_manifest(const std::string &filename, std::uint64_t dump_id,
+                    const std::vector<ManifestRange> &ranges);
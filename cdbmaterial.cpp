@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "cdbmaterial.h"
+
+namespace {
+
+const char material_magic[8] = {'C', 'D', 'B', 'M', 'A', 'T', 'R', 'L'};
+const std::uint32_t material_version = 2;
+
+const char material_pieces_order[] = "KQRBNP";
+const int material_piece_values[6] = {0, 9, 5, 3, 3, 1};
+
+// the bit offset of the count of a piece, -1 for other characters
+int piece_shift(char piece) {
+  const char *p = std::strchr(material_pieces_order, std::toupper(piece));
+  if (!piece || !p)
+    return -1;
+  return 4 * (p - material_pieces_order) + (std::islower(piece) ? 24 : 0);
+}
+
+int side_value(std::uint64_t side) {
+  int value = 0;
+  for (int i = 0; i < 6; i++)
+    value += material_piece_values[i] * ((side >> (4 * i)) & 0xF);
+  return value;
+}
+
+} // namespace
+
+std::uint64_t position_material(const KeyPosition &pos) {
+  std::uint64_t material = 0;
+  for (size_t i = 0; i < pos.board_size; i++) {
+    int shift = piece_shift(pos.board[i]);
+    if (shift >= 0 && ((material >> shift) & 0xF) < 0xF)
+      material += std::uint64_t(1) << shift;
+  }
+  return material;
+}
+
+std::uint64_t mirrored_material(std::uint64_t material) {
+  return (material >> 24) | ((material & 0xFFFFFF) << 24);
+}
+
+// the stronger side first, as white
+std::uint64_t canonical_material(std::uint64_t material) {
+  std::uint64_t white = material & 0xFFFFFF, black = material >> 24;
+  int white_value = side_value(white), black_value = side_value(black);
+  if (black_value > white_value ||
+      (black_value == white_value && black > white))
+    return mirrored_material(material);
+  return material;
+}
+
+int material_pieces(std::uint64_t material) {
+  int pieces = 0;
+  for (; material; material >>= 4)
+    pieces += material & 0xF;
+  return pieces;
+}
+
+bool parse_material(const std::string &signature, std::uint64_t &material) {
+  size_t split = signature.find_first_of("vV");
+  if (split == std::string::npos ||
+      signature.find_first_of("vV", split + 1) != std::string::npos)
+    return false;
+
+  material = 0;
+  for (size_t i = 0; i < signature.size(); i++) {
+    if (i == split)
+      continue;
+    int shift = piece_shift(std::toupper(signature[i]));
+    if (shift < 0 || ((material >> shift) & 0xF) == 0xF)
+      return false;
+    material += std::uint64_t(1) << (shift + (i > split ? 24 : 0));
+  }
+  material = canonical_material(material);
+  return true;
+}
+
+std::string material_signature(std::uint64_t material) {
+  std::string signature;
+  for (int side = 0; side < 2; side++) {
+    if (side)
+      signature += 'v';
+    for (int i = 0; i < 6; i++)
+      signature.append((material >> (24 * side + 4 * i)) & 0xF,
+                       material_pieces_order[i]);
+  }
+  return signature;
+}
+
+bool MaterialIndex::open(const std::string &filename) {
+
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  MaterialHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, material_magic, sizeof(material_magic)) ||
+      header.version != material_version) {
+    std::cerr << "Invalid material index file " << filename << std::endl;
+    return false;
+  }
+
+  // the start keys of the blocks, then per signature the material, the number
+  // of entries and of blocks, then the blocks of all signatures
+  std::vector<std::string> blocks(header.num_blocks);
+  for (auto &block : blocks) {
+    std::uint32_t size = 0;
+    file.read(reinterpret_cast<char *>(&size), sizeof(size));
+    block.resize(size);
+    file.read(&block[0], size);
+  }
+
+  std::vector<std::uint64_t> materials(header.num_signatures);
+  std::unordered_map<std::uint64_t, MaterialPostings> postings;
+  for (auto &material : materials) {
+    std::uint64_t entries = 0, num_blocks = 0;
+    file.read(reinterpret_cast<char *>(&material), sizeof(material));
+    file.read(reinterpret_cast<char *>(&entries), sizeof(entries));
+    file.read(reinterpret_cast<char *>(&num_blocks), sizeof(num_blocks));
+    if (!file || num_blocks > header.num_postings) {
+      std::cerr << "Invalid material index file " << filename << std::endl;
+      return false;
+    }
+    auto &posting = postings[material];
+    posting.entries = entries;
+    posting.blocks.resize(num_blocks);
+  }
+  for (auto material : materials) {
+    auto &posting = postings[material];
+    file.read(reinterpret_cast<char *>(posting.blocks.data()),
+              posting.blocks.size() * sizeof(std::uint32_t));
+  }
+  if (!file) {
+    std::cerr << "Truncated material index file " << filename << std::endl;
+    return false;
+  }
+
+  m_max_pieces = header.max_pieces;
+  m_dump_id = header.dump_id;
+  m_blocks = std::move(blocks);
+  m_postings = std::move(postings);
+  return true;
+}
+
+const MaterialPostings *MaterialIndex::find(std::uint64_t material) const {
+  auto it = m_postings.find(material);
+  return it == m_postings.end() ? nullptr : &it->second;
+}
+
+bool write_material(
+    const std::string &filename, std::uint64_t dump_id,
+    std::uint32_t max_pieces, std::uint64_t keys_per_block, const std::vector<std::string> &blocks,
+    const std::unordered_map<std::uint64_t, MaterialPostings> &postings) {
+
+  // in the order of the material, for files that do not depend on the build
+  std::vector<std::uint64_t> materials;
+  for (auto &posting : postings)
+    materials.push_back(posting.first);
+  std::sort(materials.begin(), materials.end());
+
+  MaterialHeader header;
+  std::memcpy(header.magic, material_magic, sizeof(material_magic));
+  header.version = material_version;
+  header.max_pieces = max_pieces;
+  header.keys_per_block = keys_per_block;
+  header.num_blocks = blocks.size();
+  header.num_signatures = materials.size();
+  header.num_postings = 0;
+  header.dump_id = dump_id;
+  for (auto &posting : postings)
+    header.num_postings += posting.second.blocks.size();
+
+  // write to a temporary name, and rename when complete
+  const std::string part_filename = filename + ".part";
+  std::ofstream file(part_filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to create material index file " << part_filename
+              << std::endl;
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (auto &block : blocks) {
+    std::uint32_t size = block.size();
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    file.write(block.data(), size);
+  }
+  for (auto material : materials) {
+    auto &posting = postings.at(material);
+    std::uint64_t num_blocks = posting.blocks.size();
+    file.write(reinterpret_cast<const char *>(&material), sizeof(material));
+    file.write(reinterpret_cast<const char *>(&posting.entries),
+               sizeof(posting.entries));
+    file.write(reinterpret_cast<const char *>(&num_blocks),
+               sizeof(num_blocks));
+  }
+  for (auto material : materials) {
+    auto &blocks_of = postings.at(material).blocks;
+    file.write(reinterpret_cast<const char *>(blocks_of.data()),
+               blocks_of.size() * sizeof(std::uint32_t));
+  }
+  file.close();
+
+  if (!file || std::rename(part_filename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Failed to write material index file " << filename
+              << std::endl;
+    std::remove(part_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fen2cdb.h"
+
+//
+// The material of a position, as the number of each piece (4 bits each, in
+// the order KQRBNP), of white in the low and of black in the high 24 bits.
+// The material signature of an endgame class, e.g. "KRPvKR", stands for both
+// colour assignments, as the DB stores a position or its BW mirror, and
+// canonical_material() maps both to the same value.
+//
+std::uint64_t position_material(const KeyPosition &pos);
+std::uint64_t mirrored_material(std::uint64_t material);
+std::uint64_t canonical_material(std::uint64_t material);
+int material_pieces(std::uint64_t material);
+
+// parse a signature as "KRPvKR" (pieces in any order, any case) into the
+// canonical material, false if invalid
+bool parse_material(const std::string &signature, std::uint64_t &material);
+std::string material_signature(std::uint64_t material);
+
+//
+// An index of the material signatures of the DB entries with few pieces, to
+// scan endgame classes without a full scan of the DB. The DB is divided into
+// consecutive blocks of keys, and per signature the index lists the blocks
+// with entries of this signature (and the exact number of entries).
+//
+// Block i covers the keys from its start key up to (excluding) the start key
+// of block i + 1, the last block is open ended. The index records the identity
+// of its dump, the blocks are only valid for that.
+//
+struct MaterialHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t max_pieces;
+  std::uint64_t keys_per_block;
+  std::uint64_t num_blocks;
+  std::uint64_t num_signatures;
+  std::uint64_t num_postings;
+  std::uint64_t dump_id;
+};
+
+struct MaterialPostings {
+  std::uint64_t entries = 0;
+  std::vector<std::uint32_t> blocks; // sorted
+};
+
+class MaterialIndex {
+public:
+  bool open(const std::string &filename);
+
+  std::uint32_t max_pieces() const { return m_max_pieces; }
+  const std::vector<std::string> &blocks() const { return m_blocks; }
+  std::uint64_t dump_id() const { return m_dump_id; }
+
+  // the postings of a canonical material, nullptr if there are no entries
+  const MaterialPostings *find(std::uint64_t material) const;
+
+private:
+  std::uint32_t m_max_pieces = 0;
+  std::uint64_t m_dump_id = 0;
+  std::vector<std::string> m_blocks;
+  std::unordered_map<std::uint64_t, MaterialPostings> m_postings;
+};
+
+bool write_material(
+    const std::string &filename, std::uint64_t dump_id,
+    std::uint32_t max_pieces, std::uint64_t keys_per_block, const std::vector<std::string> &blocks,
+    const std::unordered_map<std::uint64_t, MaterialPostings> &postings);
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "cdbmovegen.h"
+
+namespace {
+
+// a square is 8 * rank + file, a1 = 0 ... h8 = 63
+struct Position {
+  char board[64]; // fen piece letters, 0 for empty squares
+  bool white;     // to move
+  // the files of the castling rooks, by colour (white, black) and side (king,
+  // queen), -1 without the right
+  int castle_file[2][2];
+  int ep; // the ep square, -1 if none
+};
+
+struct Move {
+  int from, to;
+  char promotion; // 0 or nbrq
+  int castle;     // -1, or the side
+};
+
+const int knight_steps[8][2] = {{1, 2},   {2, 1},   {2, -1}, {1, -2},
+                                {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+const int king_steps[8][2] = {{1, 0},  {1, 1},   {0, 1},  {-1, 1},
+                              {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+const int rook_steps[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+const int bishop_steps[4][2] = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
+
+inline int file_of(int sq) { return sq % 8; }
+inline int rank_of(int sq) { return sq / 8; }
+inline bool on_board(int file, int rank) {
+  return file >= 0 && file < 8 && rank >= 0 && rank < 8;
+}
+inline bool is_own(char piece, bool white) {
+  return piece && (std::isupper(piece) != 0) == white;
+}
+// the piece of the given colour, from its lower case letter
+inline char coloured(char piece, bool white) {
+  return white ? std::toupper(piece) : piece;
+}
+
+int find_king(const char *board, bool white) {
+  for (int sq = 0; sq < 64; sq++)
+    if (board[sq] == coloured('k', white))
+      return sq;
+  return -1;
+}
+
+// is sq attacked by the pieces of the given colour on this board
+bool attacked(const char *board, int sq, bool by_white) {
+  int file = file_of(sq), rank = rank_of(sq);
+
+  // pawns attack towards the opponent
+  int pawn_rank = rank + (by_white ? -1 : 1);
+  for (int df : {-1, 1})
+    if (on_board(file + df, pawn_rank) &&
+        board[8 * pawn_rank + file + df] == coloured('p', by_white))
+      return true;
+
+  for (auto &step : knight_steps)
+    if (on_board(file + step[0], rank + step[1]) &&
+        board[8 * (rank + step[1]) + file + step[0]] ==
+            coloured('n', by_white))
+      return true;
+
+  for (auto &step : king_steps)
+    if (on_board(file + step[0], rank + step[1]) &&
+        board[8 * (rank + step[1]) + file + step[0]] ==
+            coloured('k', by_white))
+      return true;
+
+  auto slider = [&](const int (*steps)[2], char piece) {
+    for (int i = 0; i < 4; i++) {
+      int f = file + steps[i][0], r = rank + steps[i][1];
+      for (; on_board(f, r); f += steps[i][0], r += steps[i][1]) {
+        char target = board[8 * r + f];
+        if (!target)
+          continue;
+        if (target == coloured(piece, by_white) ||
+            target == coloured('q', by_white))
+          return true;
+        break;
+      }
+    }
+    return false;
+  };
+  return slider(rook_steps, 'r') || slider(bishop_steps, 'b');
+}
+
+bool parse_position(const std::string &fen, Position &pos) {
+  std::istringstream fields(fen);
+  std::string placement, stm, castling = "-", ep = "-";
+  if (!(fields >> placement >> stm))
+    return false;
+  fields >> castling >> ep;
+
+  std::memset(pos.board, 0, sizeof(pos.board));
+  int rank = 7, file = 0;
+  for (char c : placement) {
+    if (c == '/') {
+      if (file != 8 || --rank < 0)
+        return false;
+      file = 0;
+    } else if (c >= '1' && c <= '8')
+      file += c - '0';
+    else if (c && std::strchr("pnbrqkPNBRQK", c) && file < 8)
+      pos.board[8 * rank + file++] = c;
+    else
+      return false;
+    if (file > 8)
+      return false;
+  }
+  if (rank != 0 || file != 8 || (stm != "w" && stm != "b"))
+    return false;
+  pos.white = stm == "w";
+
+  // no pawns on the back ranks, whose moves would leave the board
+  for (int f = 0; f < 8; f++)
+    for (int back : {0, 56})
+      if (std::tolower(pos.board[back + f]) == 'p')
+        return false;
+
+  int kings[2] = {find_king(pos.board, true), find_king(pos.board, false)};
+  if (kings[0] < 0 || kings[1] < 0)
+    return false;
+
+  // KQkq for the outermost rook of a side, the file of the rook otherwise
+  for (auto &sides : pos.castle_file)
+    sides[0] = sides[1] = -1;
+  for (char c : castling) {
+    if (c == '-')
+      continue;
+    int colour = std::isupper(c) ? 0 : 1, back = colour ? 56 : 0;
+    char rook = colour ? 'r' : 'R', upper = std::toupper(c);
+    int king_file = file_of(kings[colour]);
+    if (rank_of(kings[colour]) != rank_of(back))
+      return false;
+    int rook_file = -1;
+    if (upper == 'K') {
+      for (int f = 7; f > king_file && rook_file < 0; f--)
+        if (pos.board[back + f] == rook)
+          rook_file = f;
+    } else if (upper == 'Q') {
+      for (int f = 0; f < king_file && rook_file < 0; f++)
+        if (pos.board[back + f] == rook)
+          rook_file = f;
+    } else if (upper >= 'A' && upper <= 'H' &&
+               pos.board[back + upper - 'A'] == rook &&
+               upper - 'A' != king_file)
+      rook_file = upper - 'A';
+    if (rook_file < 0)
+      return false;
+    pos.castle_file[colour][rook_file > king_file ? 0 : 1] = rook_file;
+  }
+
+  // the ep square of a double push of the opponent: its pawn behind the
+  // square, and the square and the one in front of it empty
+  pos.ep = -1;
+  if (ep != "-") {
+    if (ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' ||
+        ep[1] != (pos.white ? '6' : '3'))
+      return false;
+    pos.ep = 8 * (ep[1] - '1') + ep[0] - 'a';
+    int dir = pos.white ? 8 : -8;
+    if (pos.board[pos.ep - dir] != (pos.white ? 'p' : 'P') ||
+        pos.board[pos.ep] || pos.board[pos.ep + dir])
+      return false;
+  }
+  return true;
+}
+
+// the position after a pseudo legal move
+Position make_move(const Position &pos, const Move &move) {
+  Position next = pos;
+  const int colour = pos.white ? 0 : 1;
+  char piece = pos.board[move.from];
+  next.ep = -1;
+
+  if (move.castle >= 0) {
+    int back = colour ? 56 : 0;
+    int rook = back + pos.castle_file[colour][move.castle];
+    next.board[move.from] = next.board[rook] = 0;
+    next.board[back + (move.castle == 0 ? 6 : 2)] = coloured('k', pos.white);
+    next.board[back + (move.castle == 0 ? 5 : 3)] = coloured('r', pos.white);
+    next.castle_file[colour][0] = next.castle_file[colour][1] = -1;
+  } else {
+    // an ep capture removes the pawn behind the ep square
+    if (std::tolower(piece) == 'p' && move.to == pos.ep)
+      next.board[move.to + (pos.white ? -8 : 8)] = 0;
+    next.board[move.to] =
+        move.promotion ? coloured(move.promotion, pos.white) : piece;
+    next.board[move.from] = 0;
+
+    if (std::tolower(piece) == 'p' && std::abs(move.to - move.from) == 16)
+      next.ep = (move.from + move.to) / 2;
+    if (std::tolower(piece) == 'k')
+      next.castle_file[colour][0] = next.castle_file[colour][1] = -1;
+
+    // a rook that moves or is captured loses its right
+    for (int c = 0; c < 2; c++)
+      for (int side = 0; side < 2; side++) {
+        int file = pos.castle_file[c][side];
+        int rook = (c ? 56 : 0) + file;
+        if (file >= 0 && (move.from == rook || move.to == rook))
+          next.castle_file[c][side] = -1;
+      }
+  }
+
+  next.white = !pos.white;
+  return next;
+}
+
+// the side that moved did not leave its king in check
+bool is_legal(const Position &next) {
+  return !attacked(next.board, find_king(next.board, !next.white),
+                   next.white);
+}
+
+void pseudo_legal_moves(const Position &pos, std::vector<Move> &moves) {
+  const bool white = pos.white;
+  for (int from = 0; from < 64; from++) {
+    char piece = pos.board[from];
+    if (!is_own(piece, white))
+      continue;
+    int file = file_of(from), rank = rank_of(from);
+
+    auto add = [&](int to) { moves.push_back({from, to, 0, -1}); };
+    auto add_steps = [&](const int (*steps)[2], int num_steps, bool slide) {
+      for (int i = 0; i < num_steps; i++) {
+        int f = file + steps[i][0], r = rank + steps[i][1];
+        for (; on_board(f, r); f += steps[i][0], r += steps[i][1]) {
+          char target = pos.board[8 * r + f];
+          if (is_own(target, white))
+            break;
+          add(8 * r + f);
+          if (target || !slide)
+            break;
+        }
+      }
+    };
+
+    switch (std::tolower(piece)) {
+    case 'p': {
+      int dir = white ? 8 : -8, last = white ? 7 : 0;
+      auto add_pawn = [&](int to) {
+        if (rank_of(to) == last)
+          for (char promotion : {'q', 'r', 'b', 'n'})
+            moves.push_back({from, to, promotion, -1});
+        else
+          add(to);
+      };
+      if (!pos.board[from + dir]) {
+        add_pawn(from + dir);
+        if (rank == (white ? 1 : 6) && !pos.board[from + 2 * dir])
+          add(from + 2 * dir);
+      }
+      for (int df : {-1, 1}) {
+        if (!on_board(file + df, rank))
+          continue;
+        int to = from + dir + df;
+        char target = pos.board[to];
+        if ((target && !is_own(target, white)) || to == pos.ep)
+          add_pawn(to);
+      }
+      break;
+    }
+    case 'n':
+      add_steps(knight_steps, 8, false);
+      break;
+    case 'b':
+      add_steps(bishop_steps, 4, true);
+      break;
+    case 'r':
+      add_steps(rook_steps, 4, true);
+      break;
+    case 'q':
+      add_steps(rook_steps, 4, true);
+      add_steps(bishop_steps, 4, true);
+      break;
+    case 'k':
+      add_steps(king_steps, 8, false);
+      break;
+    }
+  }
+
+  // castling, also of (D)FRC: the squares between the king, the rook and their
+  // targets are empty, and the king is not attacked on its way
+  const int colour = white ? 0 : 1, back = colour ? 56 : 0;
+  const int king = find_king(pos.board, white);
+  for (int side = 0; side < 2; side++) {
+    int rook_file = pos.castle_file[colour][side];
+    if (rook_file < 0)
+      continue;
+    int rook = back + rook_file;
+    int king_to = back + (side == 0 ? 6 : 2);
+    int rook_to = back + (side == 0 ? 5 : 3);
+
+    char board[64];
+    std::memcpy(board, pos.board, sizeof(board));
+    board[king] = board[rook] = 0;
+
+    bool possible = true;
+    int low = std::min(std::min(king, rook), std::min(king_to, rook_to));
+    int high = std::max(std::max(king, rook), std::max(king_to, rook_to));
+    for (int sq = low; sq <= high && possible; sq++)
+      possible = !board[sq];
+    for (int sq = std::min(king, king_to);
+         sq <= std::max(king, king_to) && possible; sq++)
+      possible = !attacked(board, sq, !white);
+    if (possible)
+      moves.push_back({king, king_to, 0, side});
+  }
+}
+
+bool has_legal_ep(const Position &pos) {
+  if (pos.ep < 0)
+    return false;
+  int from_rank = rank_of(pos.ep) + (pos.white ? -1 : 1);
+  for (int df : {-1, 1}) {
+    int file = file_of(pos.ep) + df;
+    if (!on_board(file, from_rank) ||
+        pos.board[8 * from_rank + file] != coloured('p', pos.white))
+      continue;
+    if (is_legal(make_move(pos, {8 * from_rank + file, pos.ep, 0, -1})))
+      return true;
+  }
+  return false;
+}
+
+std::string square_name(int sq) {
+  return {char('a' + file_of(sq)), char('1' + rank_of(sq))};
+}
+
+std::string position_fen(const Position &pos) {
+  std::string fen;
+  for (int rank = 7; rank >= 0; rank--) {
+    int empty = 0;
+    for (int file = 0; file < 8; file++) {
+      char piece = pos.board[8 * rank + file];
+      if (!piece) {
+        empty++;
+        continue;
+      }
+      if (empty)
+        fen += char('0' + empty);
+      empty = 0;
+      fen += piece;
+    }
+    if (empty)
+      fen += char('0' + empty);
+    if (rank)
+      fen += '/';
+  }
+  fen += pos.white ? " w " : " b ";
+
+  // KQkq, unless another rook is further out on that side
+  std::string castling;
+  for (int colour = 0; colour < 2; colour++) {
+    int back = colour ? 56 : 0;
+    char rook = colour ? 'r' : 'R';
+    for (int side = 0; side < 2; side++) {
+      int rook_file = pos.castle_file[colour][side];
+      if (rook_file < 0)
+        continue;
+      bool outermost = true;
+      for (int f = side == 0 ? rook_file + 1 : 0;
+           f < (side == 0 ? 8 : rook_file); f++)
+        outermost = outermost && pos.board[back + f] != rook;
+      char c = outermost ? (side == 0 ? 'K' : 'Q') : char('A' + rook_file);
+      castling += colour ? char(std::tolower(c)) : c;
+    }
+  }
+  fen += castling.empty() ? "-" : castling;
+
+  fen += ' ';
+  fen += has_legal_ep(pos) ? square_name(pos.ep) : "-";
+  return fen;
+}
+
+} // namespace
+
+bool legal_children(
+    const std::string &fen,
+    std::vector<std::pair<std::string, std::string>> &children) {
+
+  Position pos;
+  if (!parse_position(fen, pos))
+    return false;
+
+  std::vector<Move> moves;
+  pseudo_legal_moves(pos, moves);
+
+  const int colour = pos.white ? 0 : 1;
+  children.clear();
+  for (auto &move : moves) {
+    Position next = make_move(pos, move);
+    if (!is_legal(next))
+      continue;
+
+    std::string uci = square_name(move.from);
+    if (move.castle < 0)
+      uci += square_name(move.to);
+    else {
+      // e1g1 in the standard setup, the king capturing its rook otherwise
+      int rook_file = pos.castle_file[colour][move.castle];
+      bool standard = file_of(move.from) == 4 &&
+                      rook_file == (move.castle == 0 ? 7 : 0);
+      uci += square_name(standard ? move.to
+                                  : 8 * rank_of(move.from) + rook_file);
+    }
+    if (move.promotion)
+      uci += move.promotion;
+    children.push_back({uci, position_fen(next)});
+  }
+  return true;
+}
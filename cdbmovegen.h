@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// A legal move generator, for the children of a position: each legal move in
+// uci notation, with the fen of the position after the move. The child fens
+// are in the strict X-FEN notation of the DB keys: an ep square only if an ep
+// capture is legal (pins included), KQkq for the outermost rooks and file
+// letters for inner rooks of (D)FRC, and no move counters. Castling is written
+// as the king's move to its target square in the standard setup (e1g1), and as
+// the king capturing its rook otherwise (as UCI_Chess960).
+//
+bool legal_children(const std::string &fen,
+                    std::vector<std::pair<std::string, std::string>> &children);
@@ -0,0 +1,74 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "cdbnuma.h"
+
+namespace {
+
+thread_local std::size_t thread_node = 0;
+
+// parse a sysfs cpu list such as "0-15,32-47"
+std::vector<int> parse_cpulist(const std::string &list) {
+  std::vector<int> cpus;
+  std::istringstream iss(list);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    if (item.empty())
+      continue;
+    auto dash = item.find('-');
+    int first = std::stoi(item.substr(0, dash));
+    int last = dash == std::string::npos ? first
+                                         : std::stoi(item.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> read_topology() {
+  std::vector<std::vector<int>> nodes;
+  for (int node = 0;; node++) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    if (!file.is_open())
+      break;
+    std::string list;
+    std::getline(file, list);
+    auto cpus = parse_cpulist(list);
+    // memory-only nodes have no cpus to run on
+    if (!cpus.empty())
+      nodes.push_back(cpus);
+  }
+  if (nodes.empty())
+    nodes.push_back({});
+  return nodes;
+}
+
+} // namespace
+
+const std::vector<std::vector<int>> &numa_topology() {
+  static const std::vector<std::vector<int>> nodes = read_topology();
+  return nodes;
+}
+
+bool numa_pin_thread(std::size_t node) {
+  const auto &nodes = numa_topology();
+  if (node >= nodes.size() || nodes[node].empty())
+    return false;
+
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int cpu : nodes[node])
+    CPU_SET(cpu, &cpuset);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+    return false;
+
+  thread_node = node;
+  return true;
+}
+
+std::size_t numa_thread_node() { return thread_node; }
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//
+// Minimal NUMA support, based on the topology in sysfs and thread affinity, so
+// that no libnuma is needed. Memory is placed by the kernel's first touch
+// policy, i.e. on the node of the pinned thread that first writes to it.
+//
+
+// the cpus of each NUMA node, a single node (with no cpus listed) if the
+// topology is not available
+const std::vector<std::vector<int>> &numa_topology();
+
+// pin the calling thread to the cpus of the given node
+bool numa_pin_thread(std::size_t node);
+
+// the node the calling thread has been pinned to, 0 if not pinned
+std::size_t numa_thread_node();
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <queue>
+#include <sstream>
+
+#include "cdbpolyglot.h"
+
+namespace {
+
+// the offsets into the Random64 numbers
+const size_t polyglot_castle = 768, polyglot_ep = 772, polyglot_turn = 780;
+const char polyglot_kinds[] = "pPnNbBrRqQkK";
+
+// the key of startpos with the Random64 numbers of Polyglot, which tells a
+// complete table in the right order from any other
+const char polyglot_startpos[] =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+const std::uint64_t polyglot_startpos_key = 0x463b96181691fc9cULL;
+
+const size_t entry_size = 16;
+const size_t entries_per_io = 65536;
+
+// the board of a fen, squares a1 = 0 ... h8 = 63, and the other fields
+struct FenBoard {
+  char square[64];
+  bool white;
+  std::string castling, ep;
+};
+
+bool parse_fen(const std::string &fen, FenBoard &board) {
+  std::istringstream fields(fen);
+  std::string placement, stm;
+  if (!(fields >> placement >> stm >> board.castling >> board.ep))
+    return false;
+
+  std::memset(board.square, 0, sizeof(board.square));
+  int rank = 7, file = 0;
+  for (char c : placement) {
+    if (c == '/') {
+      rank--;
+      file = 0;
+    } else if (c >= '1' && c <= '8')
+      file += c - '0';
+    else if (std::strchr(polyglot_kinds, c) && file < 8 && rank >= 0)
+      board.square[8 * rank + file++] = c;
+    else
+      return false;
+    if (rank < 0 || file > 8)
+      return false;
+  }
+  board.white = stm == "w";
+  return true;
+}
+
+void encode_entry(const PolyglotEntry &entry, char *out) {
+  for (int i = 0; i < 8; i++)
+    out[i] = char(entry.key >> (56 - 8 * i));
+  out[8] = char(entry.move >> 8);
+  out[9] = char(entry.move);
+  out[10] = char(entry.weight >> 8);
+  out[11] = char(entry.weight);
+  for (int i = 0; i < 4; i++)
+    out[12 + i] = char(entry.learn >> (24 - 8 * i));
+}
+
+PolyglotEntry decode_entry(const char *in) {
+  auto byte = [in](int i) { return std::uint64_t(std::uint8_t(in[i])); };
+  PolyglotEntry entry = {0, 0, 0, 0};
+  for (int i = 0; i < 8; i++)
+    entry.key = (entry.key << 8) | byte(i);
+  entry.move = std::uint16_t(byte(8) << 8 | byte(9));
+  entry.weight = std::uint16_t(byte(10) << 8 | byte(11));
+  for (int i = 12; i < 16; i++)
+    entry.learn = std::uint32_t(entry.learn << 8 | byte(i));
+  return entry;
+}
+
+// a run being merged, read in chunks
+struct RunReader {
+  std::ifstream file;
+  std::vector<char> buffer;
+  size_t size = 0, next = 0;
+
+  bool read(PolyglotEntry &entry) {
+    if (next == size) {
+      file.read(buffer.data(), buffer.size());
+      size = file.gcount() / entry_size;
+      next = 0;
+      if (!size)
+        return false;
+    }
+    entry = decode_entry(&buffer[entry_size * next++]);
+    return true;
+  }
+};
+
+} // namespace
+
+bool load_polyglot_random(const std::string &filename,
+                          std::vector<std::uint64_t> &random) {
+
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cerr << "Unable to open the Polyglot Random64 file " << filename
+              << std::endl;
+    return false;
+  }
+
+  // hex numbers separated by anything else (spaces, commas), or, if there are
+  // numbers with a 0x prefix (and maybe a U/L suffix), only those, such that
+  // the declaration of a pasted array is ignored
+  std::string text((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  const bool prefixed = text.find("0x") != std::string::npos ||
+                        text.find("0X") != std::string::npos;
+  std::vector<std::uint64_t> numbers;
+  for (size_t i = 0; i < text.size();) {
+    if (!std::isalnum(text[i])) {
+      i++;
+      continue;
+    }
+    size_t end = i;
+    while (end < text.size() && std::isalnum(text[end]))
+      end++;
+    std::string word = text.substr(i, end - i);
+    i = end;
+
+    if (word.size() > 2 && word[0] == '0' && std::tolower(word[1]) == 'x')
+      word = word.substr(2);
+    else if (prefixed)
+      continue;
+    while (prefixed && !word.empty() &&
+           (std::tolower(word.back()) == 'u' ||
+            std::tolower(word.back()) == 'l'))
+      word.pop_back();
+    if (word.empty() || word.size() > 16 ||
+        word.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+      std::cerr << "Invalid number " << word << " in " << filename
+                << std::endl;
+      return false;
+    }
+    numbers.push_back(std::stoull(word, nullptr, 16));
+  }
+
+  if (numbers.size() != polyglot_random_size) {
+    std::cerr << "Expected " << polyglot_random_size << " numbers in "
+              << filename << ", found " << numbers.size() << std::endl;
+    return false;
+  }
+
+  std::uint64_t key;
+  if (!polyglot_key(polyglot_startpos, numbers, key) ||
+      key != polyglot_startpos_key) {
+    std::cerr << "The numbers in " << filename
+              << " are not the Polyglot Random64 numbers (the key of startpos "
+              << "is " << std::hex << key << ", not " << polyglot_startpos_key
+              << ")" << std::dec << std::endl;
+    return false;
+  }
+
+  random = std::move(numbers);
+  return true;
+}
+
+bool polyglot_key(const std::string &fen,
+                  const std::vector<std::uint64_t> &random,
+                  std::uint64_t &key) {
+  FenBoard board;
+  if (random.size() != polyglot_random_size || !parse_fen(fen, board))
+    return false;
+
+  key = 0;
+  for (int sq = 0; sq < 64; sq++)
+    if (board.square[sq])
+      key ^= random[64 * (std::strchr(polyglot_kinds, board.square[sq]) -
+                          polyglot_kinds) +
+                    sq];
+
+  for (char c : board.castling) {
+    const char *p = std::strchr("KQkq", c);
+    if (c && p)
+      key ^= random[polyglot_castle + (p - "KQkq")];
+  }
+
+  // the en passant file counts only if a pawn of the side to move can capture
+  if (board.ep.size() == 2 && board.ep[0] >= 'a' && board.ep[0] <= 'h') {
+    int file = board.ep[0] - 'a', rank = board.white ? 4 : 3;
+    char pawn = board.white ? 'P' : 'p';
+    if ((file > 0 && board.square[8 * rank + file - 1] == pawn) ||
+        (file < 7 && board.square[8 * rank + file + 1] == pawn))
+      key ^= random[polyglot_ep + file];
+  }
+
+  if (board.white)
+    key ^= random[polyglot_turn];
+  return true;
+}
+
+bool polyglot_move(const std::string &fen, const std::string &move,
+                   std::uint16_t &encoded) {
+  FenBoard board;
+  if (move.size() < 4 || !parse_fen(fen, board))
+    return false;
+
+  int from_file = move[0] - 'a', from_rank = move[1] - '1',
+      to_file = move[2] - 'a', to_rank = move[3] - '1';
+  for (int c : {from_file, from_rank, to_file, to_rank})
+    if (c < 0 || c > 7)
+      return false;
+
+  // castling is encoded as the king capturing its rook
+  char piece = board.square[8 * from_rank + from_file];
+  if ((piece == 'K' || piece == 'k') && from_file == 4 &&
+      std::abs(to_file - from_file) == 2)
+    to_file = to_file > from_file ? 7 : 0;
+
+  int promotion = 0;
+  if (move.size() > 4) {
+    const char *p = std::strchr("nbrq", move[4]);
+    if (!move[4] || !p)
+      return false;
+    promotion = 1 + (p - "nbrq");
+  }
+
+  encoded = std::uint16_t(to_file | to_rank << 3 | from_file << 6 |
+                          from_rank << 9 | promotion << 12);
+  return true;
+}
+
+bool polyglot_less(const PolyglotEntry &a, const PolyglotEntry &b) {
+  if (a.key != b.key)
+    return a.key < b.key;
+  if (a.weight != b.weight)
+    return a.weight > b.weight;
+  return a.move < b.move;
+}
+
+PolyglotRuns::~PolyglotRuns() {
+  for (auto &run : m_runs)
+    std::remove(run.c_str());
+}
+
+bool PolyglotRuns::write_run(std::vector<PolyglotEntry> &entries) {
+
+  std::sort(entries.begin(), entries.end(), polyglot_less);
+
+  std::string run;
+  {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    run = m_filename + ".run" + std::to_string(m_runs.size());
+    m_runs.push_back(run);
+  }
+
+  std::ofstream file(run, std::ios::binary);
+  std::vector<char> buffer(entry_size * entries_per_io);
+  for (size_t i = 0; i < entries.size(); i += entries_per_io) {
+    size_t n = std::min(entries_per_io, entries.size() - i);
+    for (size_t j = 0; j < n; j++)
+      encode_entry(entries[i + j], &buffer[entry_size * j]);
+    file.write(buffer.data(), entry_size * n);
+  }
+  file.close();
+  entries.clear();
+
+  if (!file) {
+    std::cerr << "Failed to write the run " << run << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool PolyglotRuns::merge(std::uint64_t &num_entries) {
+
+  std::vector<std::unique_ptr<RunReader>> readers;
+  for (auto &run : m_runs) {
+    readers.emplace_back(new RunReader);
+    readers.back()->file.open(run, std::ios::binary);
+    readers.back()->buffer.resize(entry_size * entries_per_io);
+    if (!readers.back()->file.is_open()) {
+      std::cerr << "Unable to open the run " << run << std::endl;
+      return false;
+    }
+  }
+
+  // write to a temporary name, and rename when complete
+  const std::string part_filename = m_filename + ".part";
+  std::ofstream file(part_filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to create the book " << part_filename << std::endl;
+    return false;
+  }
+
+  // the smallest next entry of all runs first
+  using Head = std::pair<PolyglotEntry, size_t>;
+  auto later = [](const Head &a, const Head &b) {
+    return polyglot_less(b.first, a.first);
+  };
+  std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+  for (size_t i = 0; i < readers.size(); i++) {
+    PolyglotEntry entry;
+    if (readers[i]->read(entry))
+      heads.push({entry, i});
+  }
+
+  std::vector<char> buffer(entry_size * entries_per_io);
+  size_t buffered = 0;
+  num_entries = 0;
+
+  // the entries of one key, highest weight first. The same move of a position
+  // from several entries, e.g. with an en passant square without a capture,
+  // is kept once, with the highest weight, wherever in the group it repeats.
+  std::vector<PolyglotEntry> group;
+  auto write_group = [&]() {
+    for (size_t i = 0; i < group.size(); i++) {
+      if (std::any_of(group.begin(), group.begin() + i,
+                      [&](const PolyglotEntry &kept) {
+                        return kept.move == group[i].move;
+                      }))
+        continue;
+      num_entries++;
+      encode_entry(group[i], &buffer[entry_size * buffered++]);
+      if (buffered == entries_per_io) {
+        file.write(buffer.data(), buffer.size());
+        buffered = 0;
+      }
+    }
+    group.clear();
+  };
+
+  while (!heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+    PolyglotEntry entry;
+    if (readers[head.second]->read(entry))
+      heads.push({entry, head.second});
+
+    if (!group.empty() && head.first.key != group.front().key)
+      write_group();
+    group.push_back(head.first);
+  }
+  write_group();
+  file.write(buffer.data(), entry_size * buffered);
+  file.close();
+
+  if (!file || std::rename(part_filename.c_str(), m_filename.c_str()) != 0) {
+    std::cerr << "Failed to write the book " << m_filename << std::endl;
+    std::remove(part_filename.c_str());
+    return false;
+  }
+
+  readers.clear();
+  for (auto &run : m_runs)
+    std::remove(run.c_str());
+  m_runs.clear();
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+// Polyglot opening books: 16 byte entries of a position key, a move, a weight
+// and a learn field, big endian, sorted by key. The keys hash the position
+// with the 781 Random64 numbers of the Polyglot book format, which are read
+// from a file (as hex numbers, e.g. the array of Polyglot's source pasted
+// into a text file).
+//
+struct PolyglotEntry {
+  std::uint64_t key;
+  std::uint16_t move;
+  std::uint16_t weight;
+  std::uint32_t learn;
+};
+
+const size_t polyglot_random_size = 781;
+
+bool load_polyglot_random(const std::string &filename,
+                          std::vector<std::uint64_t> &random);
+
+// the key of a fen, and the encoding of a move (in uci, castling as the king
+// move e1g1) of that position, false if the fen is invalid
+bool polyglot_key(const std::string &fen,
+                  const std::vector<std::uint64_t> &random, std::uint64_t &key);
+bool polyglot_move(const std::string &fen, const std::string &move,
+                   std::uint16_t &encoded);
+
+// by key, and the highest weight first
+bool polyglot_less(const PolyglotEntry &a, const PolyglotEntry &b);
+
+//
+// The runs of an external sort of book entries: each full buffer of entries is
+// sorted and written as a run (itself a valid book), from any thread, and the
+// runs are merged into the book at the end, keeping each move of a key once,
+// with its highest weight. The runs are written next to the book, as
+// <book>.run<i>.
+//
+class PolyglotRuns {
+public:
+  explicit PolyglotRuns(const std::string &filename) : m_filename(filename) {}
+  ~PolyglotRuns();
+
+  // sorts entries, writes them as a run, and clears them
+  bool write_run(std::vector<PolyglotEntry> &entries);
+
+  // merge the runs into the book, removing them, and return the number of
+  // entries of the book
+  bool merge(std::uint64_t &num_entries);
+
+private:
+  std::string m_filename;
+  std::mutex m_mutex;
+  std::vector<std::string> m_runs;
+};
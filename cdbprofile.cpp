@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "cdbprofile.h"
+
+const char *profile_stage_name(ProfileStage stage) {
+  switch (stage) {
+  case ProfileStage::SCAN_ITERATE:
+    return "scan: iterate";
+  case ProfileStage::SCAN_KEY:
+    return "scan: decode key";
+  case ProfileStage::SCAN_VALUE:
+    return "scan: decode value";
+  case ProfileStage::SCAN_FEN:
+    return "scan: write fen";
+  case ProfileStage::SCAN_CALLBACK:
+    return "scan: callback";
+  case ProfileStage::PROBE_KEY:
+    return "probe: fen to key";
+  case ProfileStage::PROBE_FIND:
+    return "probe: lookup";
+  case ProfileStage::PROBE_VALUE:
+    return "probe: decode value";
+  case ProfileStage::SORT_MOVES:
+    return "sort moves (in decode value)";
+  default:
+    return "unknown";
+  }
+}
+
+#ifdef CDB_PROFILE
+
+namespace {
+
+const size_t num_stages = static_cast<size_t>(ProfileStage::NUM_STAGES);
+
+// the counters of the running threads, and the sums of the exited ones
+std::mutex registry_mutex;
+std::vector<ProfileCounters *> registry;
+std::uint64_t retired_cycles[num_stages] = {};
+std::uint64_t retired_calls[num_stages] = {};
+
+// the ticks per second, measured once against the steady clock
+double ticks_per_second() {
+  static const double rate = []() {
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t ticks = profile_ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ticks = profile_ticks() - ticks;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return ticks / elapsed.count();
+  }();
+  return rate;
+}
+
+} // namespace
+
+thread_local ProfileCounters profile_counters;
+
+ProfileCounters::ProfileCounters() {
+  const std::lock_guard<std::mutex> lock(registry_mutex);
+  registry.push_back(this);
+}
+
+ProfileCounters::~ProfileCounters() {
+  const std::lock_guard<std::mutex> lock(registry_mutex);
+  for (size_t i = 0; i < num_stages; i++) {
+    retired_cycles[i] += cycles[i].load(std::memory_order_relaxed);
+    retired_calls[i] += calls[i].load(std::memory_order_relaxed);
+  }
+  registry.erase(std::find(registry.begin(), registry.end(), this));
+}
+
+std::vector<std::pair<ProfileStage, std::pair<double, std::uint64_t>>>
+profile_report() {
+
+  std::uint64_t cycles[num_stages], calls[num_stages];
+  {
+    const std::lock_guard<std::mutex> lock(registry_mutex);
+    for (size_t i = 0; i < num_stages; i++) {
+      cycles[i] = retired_cycles[i];
+      calls[i] = retired_calls[i];
+      for (auto counters : registry) {
+        cycles[i] += counters->cycles[i].load(std::memory_order_relaxed);
+        calls[i] += counters->calls[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::vector<std::pair<ProfileStage, std::pair<double, std::uint64_t>>>
+      report;
+  for (size_t i = 0; i < num_stages; i++)
+    if (calls[i])
+      report.push_back({static_cast<ProfileStage>(i),
+                        {cycles[i] / ticks_per_second(), calls[i]}});
+  return report;
+}
+
+void profile_reset() {
+  const std::lock_guard<std::mutex> lock(registry_mutex);
+  for (size_t i = 0; i < num_stages; i++) {
+    retired_cycles[i] = retired_calls[i] = 0;
+    for (auto counters : registry) {
+      counters->cycles[i].store(0, std::memory_order_relaxed);
+      counters->calls[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+#else
+
+std::vector<std::pair<ProfileStage, std::pair<double, std::uint64_t>>>
+profile_report() {
+  return {};
+}
+
+void profile_reset() {}
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef CDB_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+#endif
+
+//
+// An opt-in profiler of the stages of the probe and scan pipelines, enabled
+// at compile time with -DCDB_PROFILE (make PROFILE=1). Each thread counts the
+// time stamp counter cycles and calls per stage in counters of its own. The
+// timers compile to nothing without CDB_PROFILE.
+//
+enum class ProfileStage {
+  SCAN_ITERATE, // Seek / Next / Valid of the iterator, and the range check
+  SCAN_KEY,     // decoding the key
+  SCAN_VALUE,   // decoding the value into scored moves
+  SCAN_FEN,     // writing the chosen fen
+  SCAN_CALLBACK,
+  PROBE_KEY,   // fen to key
+  PROBE_FIND,  // snapshot, filter and DB lookup
+  PROBE_VALUE, // decoding the value into scored moves
+  SORT_MOVES,  // part of SCAN_VALUE and PROBE_VALUE
+  NUM_STAGES
+};
+
+const char *profile_stage_name(ProfileStage stage);
+
+// the cycles and calls per stage, summed over all threads, the cycles
+// converted to seconds
+std::vector<std::pair<ProfileStage, std::pair<double, std::uint64_t>>>
+profile_report();
+void profile_reset();
+
+#ifdef CDB_PROFILE
+
+inline std::uint64_t profile_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// written by the own thread only, read by profile_report()
+struct ProfileCounters {
+  ProfileCounters();
+  ~ProfileCounters();
+
+  void add(ProfileStage stage, std::uint64_t ticks) {
+    auto i = static_cast<size_t>(stage);
+    cycles[i].store(cycles[i].load(std::memory_order_relaxed) + ticks,
+                    std::memory_order_relaxed);
+    calls[i].store(calls[i].load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t>
+      cycles[static_cast<size_t>(ProfileStage::NUM_STAGES)] = {};
+  std::atomic<std::uint64_t>
+      calls[static_cast<size_t>(ProfileStage::NUM_STAGES)] = {};
+};
+extern thread_local ProfileCounters profile_counters;
+
+// attributes the time since the previous lap (or construction) to a stage
+class ProfileLaps {
+public:
+  ProfileLaps() : m_last(profile_ticks()) {}
+  void lap(ProfileStage stage) {
+    std::uint64_t now = profile_ticks();
+    profile_counters.add(stage, now - m_last);
+    m_last = now;
+  }
+
+private:
+  std::uint64_t m_last;
+};
+
+// attributes the time of its scope to a stage
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileStage stage)
+      : m_stage(stage), m_start(profile_ticks()) {}
+  ~ProfileScope() { profile_counters.add(m_stage, profile_ticks() - m_start); }
+
+private:
+  ProfileStage m_stage;
+  std::uint64_t m_start;
+};
+
+#else
+
+class ProfileLaps {
+public:
+  void lap(ProfileStage) {}
+};
+
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileStage) {}
+};
+
+#endif
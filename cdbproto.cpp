@@ -0,0 +1,212 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+
+#include "cdbproto.h"
+
+namespace {
+
+const std::string unix_prefix = "unix:";
+
+sockaddr_un unix_address(const std::string &address, bool &ok) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::string path = address.substr(unix_prefix.size());
+  ok = !path.empty() && path.size() < sizeof(addr.sun_path);
+  if (ok)
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+// resolve "host:port", or just "port" for localhost
+addrinfo *tcp_address(const std::string &address, bool passive) {
+  auto colon = address.rfind(':');
+  std::string host = colon == std::string::npos || colon == 0
+                         ? "127.0.0.1"
+                         : address.substr(0, colon);
+  std::string port =
+      colon == std::string::npos ? address : address.substr(colon + 1);
+
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (passive)
+    hints.ai_flags = AI_PASSIVE;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+    return nullptr;
+  return result;
+}
+
+bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    // no SIGPIPE if the other side is gone, just an error
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool read_all(int fd, char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = recv(fd, data, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+} // namespace
+
+int cdb_listen(const std::string &address) {
+  if (address.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+    bool ok;
+    sockaddr_un addr = unix_address(address, ok);
+    int fd = ok ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+    if (fd < 0)
+      return -1;
+    // remove the socket of an earlier server, but no other file
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(addr.sun_path);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  addrinfo *result = tcp_address(address, true);
+  int fd = -1;
+  for (addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (result)
+    freeaddrinfo(result);
+  return fd;
+}
+
+int cdb_connect(const std::string &address) {
+  if (address.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+    bool ok;
+    sockaddr_un addr = unix_address(address, ok);
+    int fd = ok ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+    if (fd < 0)
+      return -1;
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  addrinfo *result = tcp_address(address, false);
+  int fd = -1;
+  for (addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    // small requests should not wait for more data
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  if (result)
+    freeaddrinfo(result);
+  return fd;
+}
+
+bool write_frame(int fd, CDBFrame type, const std::string &payload) {
+  std::string header;
+  put(header, std::uint32_t(payload.size()));
+  put(header, type);
+  // small frames are sent in one go
+  if (payload.size() < 4096)
+    return write_all(fd, (header + payload).data(),
+                     header.size() + payload.size());
+  return write_all(fd, header.data(), header.size()) &&
+         write_all(fd, payload.data(), payload.size());
+}
+
+bool read_frame(int fd, CDBFrame &type, std::string &payload) {
+  std::uint32_t size;
+  if (!read_all(fd, reinterpret_cast<char *>(&size), sizeof(size)) ||
+      !read_all(fd, reinterpret_cast<char *>(&type), sizeof(type)) ||
+      size > CDB_MAX_FRAME)
+    return false;
+  payload.resize(size);
+  return read_all(fd, &payload[0], size);
+}
+
+void put_string(std::string &out, const std::string &s) {
+  put(out, std::uint8_t(std::min<size_t>(s.size(), 255)));
+  out.append(s, 0, std::min<size_t>(s.size(), 255));
+}
+
+void put_scored(std::string &out,
+                const std::vector<std::pair<std::string, int>> &scored) {
+  put(out, std::uint16_t(scored.size()));
+  for (auto &pair : scored) {
+    put_string(out, pair.first);
+    put(out, std::int32_t(pair.second));
+  }
+}
+
+bool PayloadReader::get_string(std::string &s) {
+  std::uint8_t len;
+  if (!get(len))
+    return false;
+  if (m_end - m_data < len)
+    return m_ok = false;
+  s.assign(m_data, len);
+  m_data += len;
+  return true;
+}
+
+bool PayloadReader::get_scored(
+    std::vector<std::pair<std::string, int>> &scored) {
+  std::uint16_t count;
+  if (!get(count))
+    return false;
+  scored.resize(count);
+  for (auto &pair : scored) {
+    std::int32_t score;
+    if (!get_string(pair.first) || !get(score))
+      return false;
+    pair.second = score;
+  }
+  return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// The binary protocol between cdbdirect_server and its clients, over a Unix
+// domain socket ("unix:/path/to/socket") or a TCP connection ("host:port").
+// It is meant for the local machine and uses native byte order.
+//
+// Every message is a frame: a u32 payload size, a u8 frame type, and the
+// payload. A client may send several requests before reading the replies
+// (pipelining), the server answers the requests of a connection in order.
+//
+//   request             payload                        reply
+//   SIZE                -                              SIZE: u64 entries
+//   GET                 u32 n, n x (u8 len, fen)       GET: n x scored moves
+//   APPLY               u32 num_threads                ENTRIES..., DONE
+//   STOP (during APPLY) -
+//
+// where scored moves are a u16 count and count x (u8 len, move, i32 score)
+// as returned by cdbdirect_get, and ENTRIES is a u32 n and n x (u8 len, fen,
+// scored moves). A failing request, e.g. a GET of an invalid fen, is answered
+// with ERROR: the message.
+// Requests other than STOP sent during APPLY are answered after its DONE.
+//
+enum class CDBFrame : std::uint8_t {
+  SIZE = 1,
+  GET,
+  APPLY,
+  STOP,
+  ENTRIES,
+  DONE,
+  ERROR
+};
+
+// the largest accepted payload
+const std::uint32_t CDB_MAX_FRAME = 64 * 1024 * 1024;
+
+// the default address of cdbdirect_server
+#define CDB_SERVER_ADDRESS "unix:/tmp/cdbdirect.sock"
+
+// open a listening socket, or connect to one, -1 on failure
+int cdb_listen(const std::string &address);
+int cdb_connect(const std::string &address);
+
+bool write_frame(int fd, CDBFrame type, const std::string &payload);
+bool read_frame(int fd, CDBFrame &type, std::string &payload);
+
+//
+// encoding and decoding of the payloads
+//
+template <typename T> void put(std::string &out, T value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void put_string(std::string &out, const std::string &s);
+void put_scored(std::string &out,
+                const std::vector<std::pair<std::string, int>> &scored);
+
+class PayloadReader {
+public:
+  explicit PayloadReader(const std::string &payload)
+      : m_data(payload.data()), m_end(payload.data() + payload.size()) {}
+
+  template <typename T> bool get(T &value) {
+    if (m_end - m_data < (std::ptrdiff_t)sizeof(T))
+      return m_ok = false;
+    std::memcpy(&value, m_data, sizeof(T));
+    m_data += sizeof(T);
+    return true;
+  }
+
+  bool get_string(std::string &s);
+  bool get_scored(std::vector<std::pair<std::string, int>> &scored);
+
+  bool ok() const { return m_ok; }
+  bool done() const { return m_data == m_end; }
+
+private:
+  const char *m_data;
+  const char *m_end;
+  bool m_ok = true;
+};
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "cdbresults.h"
+
+namespace {
+
+const char results_magic[8] = {'C', 'D', 'B', 'R', 'S', 'L', 'T', 'S'};
+const std::uint32_t results_version = 1;
+
+} // namespace
+
+bool read_results(const std::string &filename, ScanResults &results) {
+
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  ResultsHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, results_magic, sizeof(results_magic)) ||
+      header.version != results_version) {
+    std::cerr << "Invalid results file " << filename << std::endl;
+    return false;
+  }
+
+  ScanResults read;
+  read.num_shards = header.num_shards;
+  read.shards.resize(header.num_covered);
+  read.counters.resize(header.num_counters);
+  read.histograms.assign(header.num_histograms,
+                         std::vector<std::uint64_t>(header.histogram_size));
+  file.read(reinterpret_cast<char *>(read.shards.data()),
+            read.shards.size() * sizeof(std::uint32_t));
+  file.read(reinterpret_cast<char *>(read.counters.data()),
+            read.counters.size() * sizeof(std::uint64_t));
+  for (auto &histogram : read.histograms)
+    file.read(reinterpret_cast<char *>(histogram.data()),
+              histogram.size() * sizeof(std::uint64_t));
+  if (!file) {
+    std::cerr << "Truncated results file " << filename << std::endl;
+    return false;
+  }
+
+  results = std::move(read);
+  return true;
+}
+
+bool write_results(const std::string &filename, const ScanResults &results) {
+
+  ResultsHeader header;
+  std::memcpy(header.magic, results_magic, sizeof(results_magic));
+  header.version = results_version;
+  header.reserved = 0;
+  header.num_shards = results.num_shards;
+  header.num_covered = results.shards.size();
+  header.num_counters = results.counters.size();
+  header.num_histograms = results.histograms.size();
+  header.histogram_size =
+      results.histograms.empty() ? 0 : results.histograms[0].size();
+  for (auto &histogram : results.histograms)
+    if (histogram.size() != header.histogram_size) {
+      std::cerr << "Histograms of different sizes for " << filename
+                << std::endl;
+      return false;
+    }
+
+  // write to a temporary name, and rename when complete
+  const std::string part_filename = filename + ".part";
+  std::ofstream file(part_filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to create results file " << part_filename
+              << std::endl;
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(results.shards.data()),
+             results.shards.size() * sizeof(std::uint32_t));
+  file.write(reinterpret_cast<const char *>(results.counters.data()),
+             results.counters.size() * sizeof(std::uint64_t));
+  for (auto &histogram : results.histograms)
+    file.write(reinterpret_cast<const char *>(histogram.data()),
+               histogram.size() * sizeof(std::uint64_t));
+  file.close();
+
+  if (!file || std::rename(part_filename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Failed to write results file " << filename << std::endl;
+    std::remove(part_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool merge_results(ScanResults &results, const ScanResults &other) {
+
+  if (results.shards.empty()) {
+    results = other;
+    return true;
+  }
+
+  if (results.num_shards != other.num_shards) {
+    std::cerr << "Results of " << results.num_shards << " and "
+              << other.num_shards << " shards can not be merged." << std::endl;
+    return false;
+  }
+
+  bool same_layout = results.counters.size() == other.counters.size() &&
+                     results.histograms.size() == other.histograms.size();
+  for (size_t i = 0; same_layout && i < results.histograms.size(); i++)
+    same_layout = results.histograms[i].size() == other.histograms[i].size();
+  if (!same_layout) {
+    std::cerr << "Results of different counters or histograms can not be "
+                 "merged."
+              << std::endl;
+    return false;
+  }
+
+  std::vector<std::uint32_t> shards;
+  std::set_union(results.shards.begin(), results.shards.end(),
+                 other.shards.begin(), other.shards.end(),
+                 std::back_inserter(shards));
+  if (shards.size() != results.shards.size() + other.shards.size()) {
+    std::cerr << "Results of the same shard can not be merged." << std::endl;
+    return false;
+  }
+
+  results.shards = std::move(shards);
+  for (size_t i = 0; i < results.counters.size(); i++)
+    results.counters[i] += other.counters[i];
+  for (size_t i = 0; i < results.histograms.size(); i++)
+    for (size_t j = 0; j < results.histograms[i].size(); j++)
+      results.histograms[i][j] += other.histograms[i][j];
+
+  return true;
+}
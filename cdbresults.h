@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// The mergeable results of a scan of some shards of the DB (see
+// cdbdirect_shard): counters and histograms, which are summed when merging the
+// results of the shards, and the shards covered out of num_shards.
+//
+// The file holds, in the byte order of the host:
+//   ResultsHeader
+//   std::uint32_t shards[num_covered]                      (sorted)
+//   std::uint64_t counters[num_counters]
+//   std::uint64_t histograms[num_histograms][histogram_size]
+//
+struct ResultsHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint32_t num_shards;
+  std::uint32_t num_covered;
+  std::uint64_t num_counters;
+  std::uint64_t num_histograms;
+  std::uint64_t histogram_size;
+};
+
+struct ScanResults {
+  std::uint32_t num_shards = 1;
+  std::vector<std::uint32_t> shards;
+  std::vector<std::uint64_t> counters;
+  std::vector<std::vector<std::uint64_t>> histograms;
+};
+
+bool read_results(const std::string &filename, ScanResults &results);
+bool write_results(const std::string &filename, const ScanResults &results);
+
+// add other to results, which must be of the same layout and of other shards,
+// an empty results (without shards) taking the layout of other
+bool merge_results(ScanResults &results, const ScanResults &other);
@@ -0,0 +1,52 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "cdbsidecar.h"
+
+std::string sidecar_path(const std::string &db_path, const std::string &ext) {
+  std::string base = db_path;
+  while (base.size() > 1 && base.back() == '/')
+    base.pop_back();
+  return base + "." + ext;
+}
+
+bool file_exists(const std::string &filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0;
+}
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // a shared mapping, so that several processes using the same sidecar share
+  // the pages in the page cache
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+
+  m_data = static_cast<const char *>(addr);
+  m_size = st.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (m_data)
+    munmap(const_cast<char *>(m_data), m_size);
+  m_data = nullptr;
+  m_size = 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+//
+// Helpers shared by the files that live next to a dump (filters, snapshots,
+// ...). Such sidecars are named after the DB directory, e.g. the filter of
+// /mnt/ssd/chess-20251115/data is /mnt/ssd/chess-20251115/data.filter
+//
+std::string sidecar_path(const std::string &db_path, const std::string &ext);
+bool file_exists(const std::string &filename);
+
+//
+// A read-only, shared memory mapping of a complete file
+//
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const std::string &filename);
+  void close();
+
+  const char *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+private:
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+};
+
+//
+// 64 bit hash of a DB key (or any other byte string)
+//
+inline std::uint64_t hash_mix(std::uint64_t h) {
+  // murmur3 finalizer
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline std::uint64_t hash_key(const char *data, std::size_t len) {
+  std::uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0x100000001b3ULL);
+  while (len >= 8) {
+    std::uint64_t k;
+    std::memcpy(&k, data, 8);
+    h = hash_mix(h ^ k) + 0x9e3779b97f4a7c15ULL;
+    data += 8;
+    len -= 8;
+  }
+  std::uint64_t k = 0;
+  std::memcpy(&k, data, len);
+  return hash_mix(h ^ k ^ (std::uint64_t(len) << 56));
+}
+
+inline std::uint64_t hash_key(const std::string &key) {
+  return hash_key(key.data(), key.size());
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "cdbsnapshot.h"
+
+namespace {
+
+const char snapshot_magic[8] = {'C', 'D', 'B', 'M', 'P', 'H', 'F', '\0'};
+const std::uint32_t snapshot_version = 2;
+
+// bits per key on each level, and maximal number of levels
+const double gamma_factor = 2.0;
+const std::uint32_t max_levels = 32;
+
+std::uint64_t level_position(std::uint64_t hash, const SnapshotLevel &level) {
+  return level.first_bit +
+         (std::uint64_t)(((unsigned __int128)hash_mix(hash ^ level.seed) *
+                          level.num_bits) >>
+                         64);
+}
+
+bool test_bit(const std::uint64_t *words, std::uint64_t bit) {
+  return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+void set_bit(std::vector<std::uint64_t> &words, std::uint64_t bit) {
+  words[bit / 64] |= 1ULL << (bit % 64);
+}
+
+// one rank sample per 8 words
+std::uint64_t num_rank_samples(std::uint64_t num_words) {
+  return num_words / 8 + 1;
+}
+
+std::uint64_t rank_of(const std::uint64_t *words, const std::uint64_t *ranks,
+                      std::uint64_t bit) {
+  std::uint64_t word = bit / 64;
+  std::uint64_t r = ranks[word / 8];
+  for (std::uint64_t w = word & ~7ULL; w < word; w++)
+    r += __builtin_popcountll(words[w]);
+  return r + __builtin_popcountll(words[word] & ((1ULL << (bit % 64)) - 1));
+}
+
+std::uint64_t align8(std::uint64_t bytes) { return (bytes + 7) & ~7ULL; }
+
+} // namespace
+
+bool MphfSnapshot::open(const std::string &filename) {
+
+  if (!m_file.open(filename))
+    return false;
+
+  const char *data = m_file.data();
+  m_header = reinterpret_cast<const SnapshotHeader *>(data);
+  if (m_file.size() < sizeof(SnapshotHeader) ||
+      std::memcmp(m_header->magic, snapshot_magic, sizeof(snapshot_magic)) ||
+      m_header->version != snapshot_version) {
+    std::cerr << "Invalid snapshot file " << filename << std::endl;
+    m_file.close();
+    return false;
+  }
+
+  const SnapshotHeader &h = *m_header;
+  std::uint64_t offset = sizeof(SnapshotHeader);
+  m_levels = reinterpret_cast<const SnapshotLevel *>(data + offset);
+  offset += h.num_levels * sizeof(SnapshotLevel);
+  m_words = reinterpret_cast<const std::uint64_t *>(data + offset);
+  offset += h.num_words * sizeof(std::uint64_t);
+  m_ranks = reinterpret_cast<const std::uint64_t *>(data + offset);
+  offset += num_rank_samples(h.num_words) * sizeof(std::uint64_t);
+  m_fallback = reinterpret_cast<const std::pair<std::uint64_t, std::uint64_t> *>(
+      data + offset);
+  offset += h.num_fallback * 2 * sizeof(std::uint64_t);
+  m_hashes = reinterpret_cast<const std::uint64_t *>(data + offset);
+  offset += h.num_keys * sizeof(std::uint64_t);
+  m_offsets = reinterpret_cast<const std::uint32_t *>(data + offset);
+  offset += align8((h.num_keys + 1) * sizeof(std::uint32_t));
+  m_units = reinterpret_cast<const std::uint32_t *>(data + offset);
+  offset += h.num_units * sizeof(std::uint32_t);
+
+  if (m_file.size() < offset) {
+    std::cerr << "Truncated snapshot file " << filename << std::endl;
+    m_file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool MphfSnapshot::find(std::uint64_t hash, const char *&value,
+                        std::size_t &size) const {
+
+  std::uint64_t index = m_header->num_keys;
+  for (std::uint32_t l = 0; l < m_header->num_levels; l++) {
+    std::uint64_t bit = level_position(hash, m_levels[l]);
+    if (test_bit(m_words, bit)) {
+      index = rank_of(m_words, m_ranks, bit);
+      break;
+    }
+  }
+
+  if (index == m_header->num_keys) {
+    auto end = m_fallback + m_header->num_fallback;
+    auto it = std::lower_bound(
+        m_fallback, end, hash,
+        [](const std::pair<std::uint64_t, std::uint64_t> &e, std::uint64_t h) {
+          return e.first < h;
+        });
+    if (it == end || it->first != hash)
+      return false;
+    index = it->second;
+  }
+
+  // any key maps to some index, only the stored hash tells if it is ours
+  if (m_hashes[index] != hash)
+    return false;
+
+  value = reinterpret_cast<const char *>(m_units + m_offsets[index]);
+  size = (m_offsets[index + 1] - m_offsets[index]) * sizeof(std::uint32_t);
+  return true;
+}
+
+bool write_snapshot(
+    const std::string &filename, std::uint64_t dump_id,
+    std::vector<std::pair<std::uint64_t, std::string>> &entries) {
+
+  std::sort(entries.begin(), entries.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+  entries.erase(std::unique(entries.begin(), entries.end(),
+                            [](const auto &a, const auto &b) {
+                              return a.first == b.first;
+                            }),
+                entries.end());
+
+  SnapshotHeader header;
+  std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+  header.version = snapshot_version;
+  header.dump_id = dump_id;
+  header.num_keys = entries.size();
+
+  // the levels of the perfect hash function
+  std::vector<SnapshotLevel> levels;
+  std::vector<std::uint64_t> words;
+  std::vector<std::uint64_t> remaining;
+  remaining.reserve(entries.size());
+  for (auto &e : entries)
+    remaining.push_back(e.first);
+
+  while (!remaining.empty() && levels.size() < max_levels) {
+    SnapshotLevel level;
+    level.seed = hash_mix(0x5eed0000 + levels.size());
+    level.first_bit = 0;
+    level.num_bits = std::max<std::uint64_t>(
+        64, (std::uint64_t(gamma_factor * remaining.size()) + 63) / 64 * 64);
+
+    std::vector<std::uint64_t> seen(level.num_bits / 64),
+        collision(level.num_bits / 64);
+    for (auto hash : remaining) {
+      std::uint64_t bit = level_position(hash, level);
+      if (test_bit(seen.data(), bit))
+        set_bit(collision, bit);
+      else
+        set_bit(seen, bit);
+    }
+
+    std::vector<std::uint64_t> next;
+    for (auto hash : remaining)
+      if (test_bit(collision.data(), level_position(hash, level)))
+        next.push_back(hash);
+
+    level.first_bit = words.size() * 64;
+    for (std::size_t w = 0; w < seen.size(); w++)
+      words.push_back(seen[w] & ~collision[w]);
+    levels.push_back(level);
+    remaining.swap(next);
+  }
+
+  header.num_levels = levels.size();
+  header.num_words = words.size();
+  header.num_fallback = remaining.size();
+
+  std::vector<std::uint64_t> ranks(num_rank_samples(words.size()));
+  std::uint64_t count = 0;
+  for (std::size_t w = 0; w < words.size(); w++) {
+    if (w % 8 == 0)
+      ranks[w / 8] = count;
+    count += __builtin_popcountll(words[w]);
+  }
+  if (words.size() % 8 == 0)
+    ranks.back() = count;
+
+  // the keys left after the last level get the last indices
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> fallback;
+  for (auto hash : remaining)
+    fallback.push_back({hash, count + fallback.size()});
+
+  // place each entry at its index
+  std::vector<std::uint64_t> order(entries.size());
+  std::size_t f = 0;
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    std::uint64_t hash = entries[i].first, index = entries.size();
+    for (auto &level : levels) {
+      std::uint64_t bit = level_position(hash, level);
+      if (test_bit(words.data(), bit)) {
+        index = rank_of(words.data(), ranks.data(), bit);
+        break;
+      }
+    }
+    if (index == entries.size()) // sorted like entries
+      index = fallback[f++].second;
+    order[index] = i;
+  }
+
+  std::vector<std::uint64_t> hashes(entries.size());
+  std::vector<std::uint32_t> offsets(entries.size() + 1);
+  std::uint64_t units = 0;
+  for (std::size_t index = 0; index < entries.size(); index++) {
+    const auto &e = entries[order[index]];
+    hashes[index] = e.first;
+    offsets[index] = units;
+    units += e.second.size() / sizeof(std::uint32_t);
+    if (units > UINT32_MAX) {
+      std::cerr << "Too many values for a snapshot." << std::endl;
+      return false;
+    }
+  }
+  offsets.back() = units;
+  header.num_units = units;
+
+  // write to a temporary name, and rename when complete
+  const std::string part_filename = filename + ".part";
+  std::ofstream file(part_filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to create snapshot file " << part_filename
+              << std::endl;
+    return false;
+  }
+
+  auto write = [&file](const void *data, std::size_t bytes) {
+    file.write(static_cast<const char *>(data), bytes);
+  };
+  write(&header, sizeof(header));
+  write(levels.data(), levels.size() * sizeof(SnapshotLevel));
+  write(words.data(), words.size() * sizeof(std::uint64_t));
+  write(ranks.data(), ranks.size() * sizeof(std::uint64_t));
+  write(fallback.data(), fallback.size() * 2 * sizeof(std::uint64_t));
+  write(hashes.data(), hashes.size() * sizeof(std::uint64_t));
+  write(offsets.data(), offsets.size() * sizeof(std::uint32_t));
+  const std::uint64_t zero = 0;
+  write(&zero, align8(offsets.size() * sizeof(std::uint32_t)) -
+                   offsets.size() * sizeof(std::uint32_t));
+  for (std::size_t index = 0; index < entries.size(); index++) {
+    auto &value = entries[order[index]].second;
+    write(value.data(), value.size() / sizeof(std::uint32_t) *
+                            sizeof(std::uint32_t));
+    value = std::string();
+  }
+  file.close();
+
+  if (!file || std::rename(part_filename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Failed to write snapshot file " << filename << std::endl;
+    std::remove(part_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cdbsidecar.h"
+
+//
+// A snapshot of a subset of the DB entries, as a minimal perfect hash table of
+// the key hashes with the raw DB values, designed to be used directly from a
+// (shared) memory mapping.
+//
+// The minimal perfect hash function follows Limasset et al., "Fast and
+// scalable minimal perfect hashing for massive key sets" (BBHash): on each
+// level the remaining keys are hashed into a bit array, keys without collision
+// set their bit, the others move on to the next level. The index of a key is
+// the rank of its bit over all levels. The few keys left after the last level
+// are stored in a sorted list.
+//
+// The full key hash is stored per entry to reject keys not in the snapshot,
+// and the values are packed back to back (in units of 4 bytes, the size of one
+// encoded move). The header records the dump the values are of.
+//
+struct SnapshotHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t num_levels;
+  std::uint64_t dump_id;
+  std::uint64_t num_keys;
+  std::uint64_t num_fallback;
+  std::uint64_t num_words; // of the bit arrays of all levels
+  std::uint64_t num_units; // of the values
+};
+
+struct SnapshotLevel {
+  std::uint64_t seed;
+  std::uint64_t first_bit;
+  std::uint64_t num_bits;
+};
+
+class MphfSnapshot {
+public:
+  bool open(const std::string &filename);
+
+  // find the raw value of the key with the given hash_key(), false if not in
+  // the snapshot
+  bool find(std::uint64_t hash, const char *&value, std::size_t &size) const;
+
+  std::uint64_t num_keys() const { return m_header->num_keys; }
+  std::uint64_t dump_id() const { return m_header->dump_id; }
+  std::size_t size_bytes() const { return m_file.size(); }
+
+private:
+  MappedFile m_file;
+  const SnapshotHeader *m_header = nullptr;
+  const SnapshotLevel *m_levels = nullptr;
+  const std::uint64_t *m_words = nullptr;
+  const std::uint64_t *m_ranks = nullptr;
+  const std::pair<std::uint64_t, std::uint64_t> *m_fallback = nullptr;
+  const std::uint64_t *m_hashes = nullptr;
+  const std::uint32_t *m_offsets = nullptr;
+  const std::uint32_t *m_units = nullptr;
+};
+
+// write a snapshot of the given entries (key hash and raw value) of the dump
+// with the given identity, the entries are consumed in the process
+bool write_snapshot(const std::string &filename, std::uint64_t dump_id,
+                    std::vector<std::pair<std::uint64_t, std::string>> &entries);
@@ -62,6 +62,8 @@ For more information, please refer to <https://unlicense.org>
 
 */
 
+#include <algorithm>
+#include <cctype>
 #include <cstring>
 #include <stdlib.h>
 #include <string>
@@ -72,7 +74,6 @@ For more information, please refer to <https://unlicense.org>
 
 #include "fen2cdb.h"
 
-#define CHESS_FEN_MAX_LENGTH 128
 #define CHESS_BITSTR_MAX_LENGTH 93
 
 char char2bithex(char ch) {
@@ -224,14 +225,55 @@ char bithex2extra(unsigned char ch) {
   return 'x';
 }
 
+bool cbfen_valid(const std::string &fen) {
+  size_t i = 0, ranks = 1, squares = 0;
+  for (; i < fen.size() && fen[i] != ' '; i++) {
+    char ch = fen[i];
+    if (ch == '/') {
+      if (squares != 8 || ++ranks > 8)
+        return false;
+      squares = 0;
+    } else if (ch >= '1' && ch <= '8')
+      squares += ch - '0';
+    else if (ch && std::strchr("pnbrqkPNBRQK", ch))
+      squares++;
+    else
+      return false;
+    if (squares > 8)
+      return false;
+  }
+  if (ranks != 8 || squares != 8)
+    return false;
+
+  // " w " or " b ", castling rights, " ", and the ep square
+  if (fen.size() < i + 3 || (fen[i + 1] != 'w' && fen[i + 1] != 'b') ||
+      fen[i + 2] != ' ')
+    return false;
+  size_t end = fen.find(' ', i + 3);
+  if (end == std::string::npos)
+    return false;
+  std::string castling = fen.substr(i + 3, end - i - 3);
+  std::string ep = fen.substr(end + 1);
+  if (castling != "-" &&
+      (castling.empty() || castling.size() > 4 ||
+       castling.find_first_not_of("KQkqBCDEFGbcdefg") != std::string::npos))
+    return false;
+  return ep == "-" || (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h' &&
+                       (ep[1] == '3' || ep[1] == '6'));
+}
+
 std::string cbfen2hexfen(const std::string &fen) {
   const char *fenstr = fen.data();
   size_t fenstr_len = fen.size();
 
+  // a valid fen needs fewer than 80 chars, longer input is refused rather
+  // than written past the buffer
   char bitstr[CHESS_BITSTR_MAX_LENGTH];
   size_t index = 0;
   size_t tmpindex = 0;
   while (index < fenstr_len) {
+    if (tmpindex + 3 > CHESS_BITSTR_MAX_LENGTH)
+      return "";
     char curCh = fenstr[index];
     if (curCh == ' ') {
       if (fenstr[index + 1] == 'b') {
@@ -241,6 +283,8 @@ std::string cbfen2hexfen(const std::string &fen) {
       }
       index += 3;
       while (index < fenstr_len) {
+        if (tmpindex + 3 > CHESS_BITSTR_MAX_LENGTH)
+          return "";
         bitstr[tmpindex++] = extra2bithex(fenstr[index++]);
         if (bitstr[tmpindex - 1] == 'e') {
           bitstr[tmpindex++] = extra2bithex(tolower(fenstr[index - 1]));
@@ -270,6 +314,31 @@ std::string cbfen2hexfen(const std::string &fen) {
   return std::string(bitstr);
 }
 
+// the hexfen of the leading ranks of a board, from rank 8, as in a fen (e.g.
+// "r3k2r/pppppppp"), which is a prefix of the hexfen of every position with
+// these ranks, empty if a rank is not complete
+std::string cbranks2hexfen(const std::string &ranks) {
+  std::string hexfen;
+  size_t num_ranks = 1, squares = 0;
+  for (char ch : ranks) {
+    if (ch == '/') {
+      if (squares != 8 || ++num_ranks > 8)
+        return "";
+      squares = 0;
+    } else if (ch >= '1' && ch <= '8') {
+      squares += ch - '0';
+      hexfen += char2bithex(ch);
+      if (ch >= '4')
+        hexfen += ch - 4;
+    } else if (std::strchr("pnbrqkPNBRQK", ch) && ch) {
+      squares++;
+      hexfen += char2bithex(ch);
+    } else
+      return "";
+  }
+  return squares == 8 ? hexfen : "";
+}
+
 std::string cbhexfen2fen(const std::string &hexfen) {
   const char *fenstr = hexfen.data();
   size_t fenstr_len = hexfen.size();
@@ -338,6 +407,10 @@ const char MoveToBW[128] = {
 std::string cbgetBWfen(const std::string &orig) {
   const char *fenstr = orig.data();
   size_t fenstr_len = orig.size();
+  // the mirrored fen is as long as the fen, which must fit the buffers (with
+  // the fields after the board written at most 4 chars past its end)
+  if (fenstr_len + 4 > CHESS_FEN_MAX_LENGTH)
+    return "";
   char fen[CHESS_FEN_MAX_LENGTH];
   char tmp[CHESS_FEN_MAX_LENGTH];
   size_t index = 0;
@@ -356,14 +429,14 @@ std::string cbgetBWfen(const std::string &orig) {
       }
       index += 3;
       tmpidx = 0;
-      char tmp2[4];
+      char tmp2[CHESS_FEN_MAX_LENGTH];
       int tmpidx2 = 0;
-      do {
+      while (index < fenstr_len && fenstr[index] != ' ') {
         if (isupper(fenstr[index]))
           tmp2[tmpidx2++] = tolower(fenstr[index++]);
         else
           tmp[tmpidx++] = toupper(fenstr[index++]);
-      } while (fenstr[index] != ' ');
+      }
       tmp[tmpidx] = '\0';
       tmp2[tmpidx2++] = ' ';
       tmp2[tmpidx2] = '\0';
@@ -447,6 +520,128 @@ std::string bin2hex(const std::string &bin) {
   return ss.str();
 }
 
+// the tables of bithex2char, bithex2extra and hex digits by nibble, and a case
+// swap of the fen characters for the BW mirror
+const char NibbleToChar[16] = {'1', '2', '3', 'p', 'n', 'b', 'r', 'q',
+                               0,   'k', 'P', 'N', 'B', 'R', 'Q', 'K'};
+const char NibbleToExtra[16] = {'-', 'a', 'b', 'c', 'd', 'e', 'f', 'g',
+                                'h', ' ', 'K', 'Q', 'k', 'q', 'x', 'x'};
+const char NibbleToHex[16] = {'0', '1', '2', '3', '4', '5', '6', '7',
+                              '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+struct SwapCaseTable {
+  char table[256];
+  SwapCaseTable() {
+    for (int c = 0; c < 256; c++)
+      table[c] = isupper(c) ? tolower(c) : toupper(c);
+  }
+};
+const SwapCaseTable SwapCase;
+
+// decodes the same as cbhexfen2fen(bin2hex(bin)), without the hex string
+void cbdecodekey(const char *bin, size_t size, KeyPosition &pos) {
+  const unsigned char *data = reinterpret_cast<const unsigned char *>(bin);
+  const size_t num_nibbles = 2 * size;
+  size_t index = 0;
+  auto nibble = [&]() -> int {
+    if (index >= num_nibbles)
+      return -1;
+    int n = index % 2 ? data[index / 2] & 0xF : data[index / 2] >> 4;
+    index++;
+    return n;
+  };
+
+  pos.board_size = 0;
+  pos.num_ranks = 1;
+  pos.rank_start[0] = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    if (sq != 0 && (sq % 8) == 0) {
+      pos.board[pos.board_size++] = '/';
+      pos.rank_start[pos.num_ranks++] = pos.board_size;
+    }
+    int n = nibble();
+    if (n < 0)
+      n = 0;
+    if (n == 8) {
+      int empty = std::max(nibble(), 0);
+      pos.board[pos.board_size++] = '4' + empty;
+      sq += empty + 3;
+    } else {
+      pos.board[pos.board_size++] = NibbleToChar[n];
+      if (n == 1 || n == 2)
+        sq += n;
+    }
+  }
+
+  pos.black = nibble() > 0;
+
+  pos.castling_size = 0;
+  for (int n = nibble(); n >= 0 && n != 9; n = nibble()) {
+    char c = NibbleToExtra[n];
+    if (n == 0xe) {
+      n = nibble();
+      c = n < 0 ? 'x' : toupper(NibbleToExtra[n]);
+    }
+    if (pos.castling_size < sizeof(pos.castling))
+      pos.castling[pos.castling_size++] = c;
+  }
+
+  pos.ep_size = 1;
+  pos.ep[0] = '-';
+  int n = nibble();
+  if (n > 0) {
+    pos.ep[0] = NibbleToExtra[n];
+    n = nibble();
+    if (n >= 0)
+      pos.ep[pos.ep_size++] = NibbleToHex[n];
+  }
+}
+
+// writes the fen of the position, or the same as cbgetBWfen of it
+size_t cbkeyposition2fen(const KeyPosition &pos, bool mirror, char *fen) {
+  size_t size = 0;
+
+  if (!mirror) {
+    std::memcpy(fen, pos.board, pos.board_size);
+    size = pos.board_size;
+  } else {
+    for (int rank = pos.num_ranks - 1; rank >= 0; rank--) {
+      size_t end = rank + 1 < pos.num_ranks ? pos.rank_start[rank + 1] - 1
+                                            : pos.board_size;
+      for (size_t i = pos.rank_start[rank]; i < end; i++)
+        fen[size++] = SwapCase.table[static_cast<unsigned char>(pos.board[i])];
+      if (rank > 0)
+        fen[size++] = '/';
+    }
+  }
+
+  fen[size++] = ' ';
+  fen[size++] = pos.black != mirror ? 'b' : 'w';
+  fen[size++] = ' ';
+
+  if (!mirror) {
+    std::memcpy(fen + size, pos.castling, pos.castling_size);
+    size += pos.castling_size;
+  } else {
+    // the black rights first, as white ones, then the white rights
+    for (size_t i = 0; i < pos.castling_size; i++)
+      if (!isupper(pos.castling[i]))
+        fen[size++] = toupper(pos.castling[i]);
+    for (size_t i = 0; i < pos.castling_size; i++)
+      if (isupper(pos.castling[i]))
+        fen[size++] = tolower(pos.castling[i]);
+  }
+  fen[size++] = ' ';
+
+  for (size_t i = 0; i < pos.ep_size; i++) {
+    char tmp = mirror ? MoveToBW[int(pos.ep[i])] : 0;
+    fen[size++] = tmp ? tmp : pos.ep[i];
+  }
+  fen[size] = '\0';
+
+  return size;
+}
+
 const char SQ_File[90] = {
     'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'a', 'b', 'c', 'd', 'e', 'f',
     'g', 'h', 'i', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'a', 'b', 'c',
@@ -464,49 +659,67 @@ const char SQ_Rank[90] = {
     '8', '8', '8', '8', '8', '8', '9', '9', '9', '9', '9', '9', '9', '9', '9',
 };
 
-int decode_hash_value(const Bytes &slice, std::string *key,
-                      std::string *value) {
-  if (slice.size() < 2 * sizeof(int16_t)) {
-    return -1;
-  }
-  int16_t encoded = *(int16_t *)slice.data();
+int decode_move(int16_t encoded, char *move) {
   int src = encoded >> 8;
   int dst = encoded & 0x7F;
   if (encoded & 0x80) {
-    key->resize(5);
-    (*key)[0] = SQ_File[src];
-    (*key)[1] = SQ_Rank[src];
-    (*key)[2] = SQ_File[dst];
+    move[0] = SQ_File[src];
+    move[1] = SQ_Rank[src];
+    move[2] = SQ_File[dst];
     if (SQ_Rank[src] == '7')
-      (*key)[3] = '8';
+      move[3] = '8';
     else if (SQ_Rank[src] == '2')
-      (*key)[3] = '1';
+      move[3] = '1';
     else
       return -1;
 
     switch (SQ_Rank[dst]) {
     case '0':
-      (*key)[4] = 'q';
+      move[4] = 'q';
       break;
     case '1':
-      (*key)[4] = 'r';
+      move[4] = 'r';
       break;
     case '2':
-      (*key)[4] = 'b';
+      move[4] = 'b';
       break;
     case '3':
-      (*key)[4] = 'n';
+      move[4] = 'n';
       break;
     default:
       return -1;
     }
+    move[5] = '\0';
+    return 5;
   } else {
-    key->resize(4);
-    (*key)[0] = SQ_File[src];
-    (*key)[1] = SQ_Rank[src];
-    (*key)[2] = SQ_File[dst];
-    (*key)[3] = SQ_Rank[dst];
+    move[0] = SQ_File[src];
+    move[1] = SQ_Rank[src];
+    move[2] = SQ_File[dst];
+    move[3] = SQ_Rank[dst];
+    move[4] = '\0';
+    return 4;
+  }
+}
+
+void cbmirrormove(char *move) {
+  for (int i = 0; i < 4; i++) {
+    char tmp = MoveToBW[int(move[i])];
+    if (tmp)
+      move[i] = tmp;
+  }
+}
+
+int decode_hash_value(const Bytes &slice, std::string *key,
+                      std::string *value) {
+  if (slice.size() < 2 * sizeof(int16_t)) {
+    return -1;
   }
+  int16_t encoded = *(int16_t *)slice.data();
+  char move[6];
+  int len = decode_move(encoded, move);
+  if (len < 0)
+    return -1;
+  key->assign(move, len);
   int16_t val = *(int16_t *)(slice.data() + sizeof(int16_t));
   *value = std::to_string(val);
   return 0;
@@ -1,17 +1,47 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#define CHESS_FEN_MAX_LENGTH 128
+
 using Bytes = std::string;
 using StrPair = std::pair<std::string, std::string>;
 using BytesPair = std::pair<Bytes, Bytes>;
 
+// whether a fen (without move counters) has the form the conversions below
+// expect: 8 ranks of 8 squares, the side to move, and the castling and ep
+// fields of the DB keys, which bounds the sizes of their buffers
+bool cbfen_valid(const std::string &fen);
 std::string cbfen2hexfen(const std::string &fen);
 std::string cbhexfen2fen(const std::string &hexfen);
+std::string cbranks2hexfen(const std::string &ranks);
 std::string hex2bin(const std::string &hex);
 std::string bin2hex(const std::string &bin);
 std::string cbgetBWfen(const std::string &orig);
 std::string cbgetBWmove(const std::string &move);
+
+//
+// A position decoded straight from a binary hexfen (a DB key without its 'h'
+// prefix), from which the fen or its BW mirror is written into a buffer of
+// CHESS_FEN_MAX_LENGTH chars, without the intermediate hex and fen strings
+//
+struct KeyPosition {
+  char board[72];
+  std::uint8_t board_size;
+  std::uint8_t rank_start[8];
+  std::uint8_t num_ranks;
+  bool black;
+  char castling[16];
+  std::uint8_t castling_size;
+  char ep[2];
+  std::uint8_t ep_size;
+};
+void cbdecodekey(const char *bin, size_t size, KeyPosition &pos);
+size_t cbkeyposition2fen(const KeyPosition &pos, bool mirror, char *fen);
+
+int decode_move(int16_t encoded, char *move);
+void cbmirrormove(char *move);
 int get_hash_values(const Bytes &slice, std::vector<StrPair> &values);
@@ -12,11 +12,25 @@
 int main(int argc, char *argv[]) {
 
   std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+  std::cout << "Opened DB, time (s) per phase:";
+  for (auto &phase : cdbdirect_open_timings(handle))
+    std::cout << " " << phase.first << ": " << phase.second << ",";
+  std::cout << " io mode: " << cdbdirect_io_mode(handle) << std::endl;
+
   std::string filename = "caissa_sorted_100000.epd";
 
   if (argc > 1)
     filename = argv[1];
 
+  // optionally serve the positions in a snapshot without accessing the DB
+  if (argc > 2) {
+    if (!cdbdirect_load_snapshot(handle, argv[2])) {
+      std::cerr << "Error: Unable to load snapshot " << argv[2] << std::endl;
+      return 1;
+    }
+    std::cout << "Using snapshot: " << argv[2] << std::endl;
+  }
+
   std::cout << "Reading FENs from: " << filename << std::endl;
 
   // open file with fen/epd
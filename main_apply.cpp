@@ -1,29 +1,85 @@
 #include "cdbdirect.h"
+#include "cdbresults.h"
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <memory>
 #include <thread>
+#include <vector>
+
+// statistics gathered by the threads of one NUMA node
+struct Stats {
+  using Histogram = std::array<std::atomic<size_t>, 65536>;
+  std::atomic<size_t> count_have_minply{0};
+  std::atomic<size_t> count_have_single{0};
+  std::atomic<size_t> count_moves{0};
+  Histogram min_ply_histogram = {};
+  Histogram score_histogram = {};
+};
 
 int main(int argc, char *argv[]) {
-  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
 
+  // --numa pins the threads per NUMA node, with per-node statistics
+  // --checkpoint <file> resumes from and periodically writes a checkpoint
+  // --shard i/N analyses shard i (counting from 0) of N shards of the DB
+  // --results <file> writes the results for cdbdirect_merge
+  // --readahead <bytes> sets the readahead of the scan (0: adaptive)
+  bool numa = false;
+  CDBOpenOptions options;
+  std::string checkpoint_file, results_file;
+  size_t shard = 0, num_shards = 1;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--numa")
+      numa = true;
+    else if (std::string(argv[i]) == "--checkpoint" && i + 1 < argc)
+      checkpoint_file = argv[++i];
+    else if (std::string(argv[i]) == "--shard" && i + 1 < argc) {
+      std::string arg = argv[++i];
+      size_t slash = arg.find('/');
+      if (slash != std::string::npos) {
+        shard = std::stoull(arg.substr(0, slash));
+        num_shards = std::stoull(arg.substr(slash + 1));
+      }
+      if (slash == std::string::npos || num_shards == 0 ||
+          shard >= num_shards) {
+        std::cerr << "Error: --shard needs i/N with 0 <= i < N." << std::endl;
+        return 1;
+      }
+    } else if (std::string(argv[i]) == "--results" && i + 1 < argc)
+      results_file = argv[++i];
+    else if (std::string(argv[i]) == "--readahead" && i + 1 < argc)
+      options.scan_readahead_size = std::stoull(argv[++i]);
+    else
+      args.push_back(argv[i]);
+  }
+  if (num_shards > 1 && results_file.empty())
+    results_file = "shard_" + std::to_string(shard) + "_of_" +
+                   std::to_string(num_shards) + ".results";
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH, options);
+
+  // the count is exact if a manifest of the key ranges has been built
   std::uint64_t db_size = cdbdirect_size(handle);
-  std::cout << "DB count: " << db_size << std::endl;
+  bool exact = !cdbdirect_ranges(handle).empty();
+  std::cout << "DB count: " << db_size << (exact ? "" : " (estimate)")
+            << std::endl;
 
   size_t max_entries = 1'000'000'000UL;
-  if (argc > 1) { // either pass max_entries as integer
-    size_t cli = std::stoull(argv[1]);
-    if (cli > 1 || std::string(argv[1]) == "1") {
+  if (args.size() > 0) { // either pass max_entries as integer
+    size_t cli = std::stoull(args[0]);
+    if (cli > 1 || args[0] == "1") {
       max_entries = cli;
       if (max_entries == 1)
         std::cout << "Use '" << argv[0] << " 1.0' to analyse the whole DB."
                   << std::endl;
     } else { // or pass a fraction of total DB, like 0.5 or 1.0
-      double fraction = std::stod(argv[1]);
+      double fraction = std::stod(args[0]);
       max_entries = std::size_t(fraction * db_size);
     }
   }
@@ -31,51 +87,93 @@ int main(int argc, char *argv[]) {
   std::cout << "Analyse the first " << max_entries << " DB entries ..."
             << std::endl;
 
+  // the key range of the shard, and about the number of entries in it
+  CDBKeyRange key_range;
+  size_t expected_entries = max_entries;
+  if (num_shards > 1) {
+    key_range = cdbdirect_shard(handle, shard, num_shards);
+    expected_entries = std::min(max_entries, db_size / num_shards);
+    std::cout << "... of shard " << shard << " of " << num_shards
+              << ", results to " << results_file << std::endl;
+  }
+
+  // the statistics of each node are allocated by a thread on that node
+  const size_t num_nodes = numa ? cdbdirect_numa_nodes() : 1;
+  cdbdirect_set_numa(handle, numa);
+  std::vector<std::unique_ptr<Stats>> node_stats(num_nodes);
+  for (size_t node = 0; node < num_nodes; node++)
+    std::thread([&node_stats, node, numa]() {
+      if (numa)
+        cdbdirect_numa_pin(node);
+      node_stats[node] = std::make_unique<Stats>();
+    }).join();
+  if (numa)
+    std::cout << "Using " << num_nodes << " NUMA nodes." << std::endl;
+
+  auto sum = [&node_stats](std::atomic<size_t> Stats::*counter) {
+    size_t total = 0;
+    for (auto &stats : node_stats)
+      total += ((*stats).*counter).load();
+    return total;
+  };
+
+  auto histogram_sum = [&node_stats](Stats::Histogram Stats::*histogram,
+                                       size_t i) {
+    size_t total = 0;
+    for (auto &stats : node_stats)
+      total += ((*stats).*histogram)[i].load();
+    return total;
+  };
+
   // setup of a function that will be called for each entry in the db,
   // multithreaded
   std::atomic<size_t> count_total(0);
-  std::atomic<size_t> count_have_minply(0);
-  std::atomic<size_t> count_have_single(0);
-  std::atomic<size_t> count_moves(0);
+  size_t count_resumed = 0;
   auto start = std::chrono::steady_clock::now();
 
-  std::array<std::atomic<size_t>, 65536> min_ply_histogram = {};
-  std::array<std::atomic<size_t>, 65536> score_histogram = {};
-
   auto evaluate_entry = [&](const std::string &fen,
                             const std::vector<std::pair<std::string, int>>
                                 &scored) {
+    Stats &stats = *node_stats[numa ? cdbdirect_numa_node() : 0];
+
     // distribution of min ply
     int index_min_Ply = std::clamp(scored.back().second, 0, 65535);
-    min_ply_histogram[index_min_Ply].fetch_add(1, std::memory_order_relaxed);
+    stats.min_ply_histogram[index_min_Ply].fetch_add(
+        1, std::memory_order_relaxed);
     // distribution of scores
     int index_score = std::clamp(scored.front().second + 32768, 0, 65535);
-    score_histogram[index_score].fetch_add(1, std::memory_order_relaxed);
+    stats.score_histogram[index_score].fetch_add(1, std::memory_order_relaxed);
 
     // count entries
     size_t peek = count_total.fetch_add(1, std::memory_order_relaxed);
     if (scored.back().second > -1)
-      count_have_minply.fetch_add(1, std::memory_order_relaxed);
+      stats.count_have_minply.fetch_add(1, std::memory_order_relaxed);
     if (scored.size() == 2)
-      count_have_single.fetch_add(1, std::memory_order_relaxed);
-    count_moves.fetch_add(scored.size() - 1, std::memory_order_relaxed);
+      stats.count_have_single.fetch_add(1, std::memory_order_relaxed);
+    stats.count_moves.fetch_add(scored.size() - 1, std::memory_order_relaxed);
 
     // status update
     if (peek % 10000000 == 0 && peek > 0) {
       auto end = std::chrono::steady_clock::now();
       auto elapsed =
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      std::cout << "Counted               " << peek << " of " << max_entries
-                << " entries so far..."
+      std::cout << "Counted               " << peek << " of "
+                << expected_entries << " entries so far..."
                 << "\n";
-      std::cout << "  Have min ply:       " << count_have_minply.load() << "\n";
-      std::cout << "  Have single move:   " << count_have_single.load() << "\n";
-      std::cout << "  Total scored moves: " << count_moves.load() << "\n";
-      std::cout << "  Time (s):           " << elapsed.count() / 1000.0 << "\n";
-      std::cout << "  nps:                " << peek * 1000 / elapsed.count()
+      std::cout << "  Have min ply:       " << sum(&Stats::count_have_minply)
+                << "\n";
+      std::cout << "  Have single move:   " << sum(&Stats::count_have_single)
                 << "\n";
+      std::cout << "  Total scored moves: " << sum(&Stats::count_moves)
+                << "\n";
+      std::cout << "  Time (s):           " << elapsed.count() / 1000.0 << "\n";
+      // the entries counted by this run, not before a resume
+      size_t counted = std::max<size_t>(peek - count_resumed, 1);
+      std::cout << "  nps:                "
+                << counted * 1000 / std::max<long>(elapsed.count(), 1) << "\n";
       std::cout << "  ETA (s):            "
-                << (max_entries - peek) * elapsed.count() / (peek * 1000)
+                << (std::max(expected_entries, peek) - peek) *
+                       elapsed.count() / (counted * 1000)
                 << "\n";
       /*
       std::cout << fen << "\n";
@@ -90,26 +188,98 @@ int main(int argc, char *argv[]) {
 
   // evaluate all entries in the db, using multiple threads
   const size_t num_threads = std::thread::hardware_concurrency();
-  cdbdirect_apply(handle, num_threads, evaluate_entry);
+  CDBScanStatus status = CDBScanStatus::COMPLETED;
+  if (checkpoint_file.empty())
+    cdbdirect_apply_range(handle, num_threads, evaluate_entry, key_range);
+  else {
+    // the state of the analysis: the counters and histograms, summed over the
+    // nodes
+    CDBCheckpoint checkpoint;
+    checkpoint.filename = checkpoint_file;
+    checkpoint.save = [&]() {
+      std::vector<size_t> state = {count_total, sum(&Stats::count_have_minply),
+                                   sum(&Stats::count_have_single),
+                                   sum(&Stats::count_moves)};
+      for (size_t i = 0; i < 65536; ++i)
+        state.push_back(histogram_sum(&Stats::min_ply_histogram, i));
+      for (size_t i = 0; i < 65536; ++i)
+        state.push_back(histogram_sum(&Stats::score_histogram, i));
+      return std::string(reinterpret_cast<const char *>(state.data()),
+                         state.size() * sizeof(size_t));
+    };
+    checkpoint.load = [&](const std::string &data) {
+      std::vector<size_t> state(data.size() / sizeof(size_t));
+      std::memcpy(state.data(), data.data(), state.size() * sizeof(size_t));
+      if (state.size() != 4 + 2 * 65536)
+        return;
+      Stats &stats = *node_stats[0];
+      count_total = count_resumed = state[0];
+      stats.count_have_minply = state[1];
+      stats.count_have_single = state[2];
+      stats.count_moves = state[3];
+      for (size_t i = 0; i < 65536; ++i) {
+        stats.min_ply_histogram[i] = state[4 + i];
+        stats.score_histogram[i] = state[4 + 65536 + i];
+      }
+      std::cout << "Resumed from " << checkpoint_file << " after "
+                << count_resumed << " entries." << std::endl;
+    };
+    status = cdbdirect_apply_range(handle, num_threads, evaluate_entry,
+                                   key_range, checkpoint);
+    if (status == CDBScanStatus::STOPPED)
+      std::cout << "Stopped, to be continued with --checkpoint "
+                << checkpoint_file << std::endl;
+    else if (status == CDBScanStatus::FAILED)
+      std::cout << "Failed, with the checkpoint " << checkpoint_file
+                << " (see above)" << std::endl;
+  }
 
   // Final status update
   std::cout << "Final count:          " << count_total << std::endl;
-  std::cout << "  Have min ply:       " << count_have_minply.load() << "\n";
-  std::cout << "  Have single move:   " << count_have_single.load() << "\n";
-  std::cout << "  Total scored moves: " << count_moves.load() << "\n";
+  std::cout << "  Have min ply:       " << sum(&Stats::count_have_minply)
+            << "\n";
+  std::cout << "  Have single move:   " << sum(&Stats::count_have_single)
+            << "\n";
+  std::cout << "  Total scored moves: " << sum(&Stats::count_moves) << "\n";
+
+  // the time per stage, if built with PROFILE=1
+  for (auto &stage : cdbdirect_profile())
+    std::cout << "  " << stage.stage << ": " << stage.seconds << " s, "
+              << stage.calls << " calls\n";
 
   std::ofstream file_ply("min_ply_histogram.txt");
-  for (size_t i = 0; i < min_ply_histogram.size(); ++i) {
-    file_ply << i << " " << min_ply_histogram[i].load() << "\n";
+  for (size_t i = 0; i < 65536; ++i) {
+    file_ply << i << " " << histogram_sum(&Stats::min_ply_histogram, i)
+             << "\n";
   }
   file_ply.close();
 
   std::ofstream file_score("score_histogram.txt");
-  for (size_t i = 0; i < score_histogram.size(); ++i) {
-    file_score << int(i) - 32768 << " " << score_histogram[i].load() << "\n";
+  for (size_t i = 0; i < 65536; ++i) {
+    file_score << int(i) - 32768 << " "
+               << histogram_sum(&Stats::score_histogram, i) << "\n";
   }
   file_score.close();
 
+  // the counters and the histograms of min ply and score, see cdbresults.h
+  if (!results_file.empty()) {
+    ScanResults results;
+    results.num_shards = num_shards;
+    results.shards = {std::uint32_t(shard)};
+    results.counters = {count_total, sum(&Stats::count_have_minply),
+                        sum(&Stats::count_have_single),
+                        sum(&Stats::count_moves)};
+    results.histograms.assign(2, std::vector<std::uint64_t>(65536));
+    for (size_t i = 0; i < 65536; ++i) {
+      results.histograms[0][i] = histogram_sum(&Stats::min_ply_histogram, i);
+      results.histograms[1][i] = histogram_sum(&Stats::score_histogram, i);
+    }
+    if (!write_results(results_file, results)) {
+      cdbdirect_finalize(handle);
+      return 1;
+    }
+  }
+
   cdbdirect_finalize(handle);
-  return 0;
+  return status == CDBScanStatus::FAILED;
 }
@@ -0,0 +1,19 @@
+#include "cdbdirect.h"
+#include <cstdint>
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+
+  // time random probes and sequential scans with each I/O mode, the selected
+  // mode is stored next to the dump, and used by later cdbdirect_initialize()
+  CDBOpenOptions options;
+  options.calibrate = true;
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH, options);
+
+  std::cout << "Opened DB with " << cdbdirect_size(handle)
+            << " stored positions, using I/O mode "
+            << cdbdirect_io_mode(handle) << "." << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
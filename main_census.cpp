@@ -0,0 +1,58 @@
+#include "cdbdirect.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+
+  // --count only counts the entries, without decoding the keys
+  bool count_only = argc > 1 && std::string(argv[1]) == "--count";
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+  std::cout << "DB count: " << cdbdirect_size(handle) << " (estimate)"
+            << std::endl;
+
+  // the number of pieces, and the side to move, of the keys
+  std::array<std::atomic<std::uint64_t>, 33> pieces = {};
+  std::atomic<std::uint64_t> white_to_move(0);
+  auto census = [&](const std::string &fen) {
+    size_t count = 0, i = 0;
+    for (; i < fen.size() && fen[i] != ' '; i++)
+      count += std::isalpha(static_cast<unsigned char>(fen[i])) != 0;
+    pieces[std::min<size_t>(count, 32)].fetch_add(1,
+                                                   std::memory_order_relaxed);
+    if (i + 1 < fen.size() && fen[i + 1] == 'w')
+      white_to_move.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  };
+
+  const size_t num_threads = std::thread::hardware_concurrency();
+  auto start = std::chrono::steady_clock::now();
+  std::uint64_t keys =
+      count_only ? cdbdirect_apply_keys(handle, num_threads, nullptr)
+                 : cdbdirect_apply_keys(handle, num_threads, census);
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+
+  std::cout << "Entries (exact): " << keys << std::endl;
+  if (!count_only) {
+    std::cout << "White to move (in key orientation): " << white_to_move
+              << std::endl;
+    std::cout << "Entries by number of pieces:" << std::endl;
+    for (size_t n = 0; n < pieces.size(); n++)
+      if (pieces[n])
+        std::cout << "  " << n << " " << pieces[n] << std::endl;
+  }
+  std::cout << "Time (s): " << seconds << std::endl;
+  std::cout << "Keys per second: " << keys / std::max(seconds, 1e-9)
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
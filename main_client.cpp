@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cdbclient.h"
+
+int main(int argc, char *argv[]) {
+
+  std::string filename = argc > 1 ? argv[1] : "caissa_sorted_100000.epd";
+  std::string address = argc > 2 ? argv[2] : "";
+
+  std::uintptr_t handle = cdbclient_connect(address);
+  if (!handle)
+    return 1;
+
+  try {
+    std::cout << "Server DB contains " << cdbclient_size(handle)
+              << " positions." << std::endl;
+  } catch (const CDBClientError &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    cdbclient_close(handle);
+    return 1;
+  }
+  std::cout << "Reading FENs from: " << filename << std::endl;
+
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cerr << "Error: Unable to open file." << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> fens;
+  std::string line;
+  while (std::getline(file, line)) {
+    // Retain just the first 4 fields, no move counters etc
+    std::istringstream iss(line);
+    std::string word, fen;
+    int wordCount = 0;
+    while (iss >> word && wordCount < 4) {
+      if (wordCount > 0)
+        fen += " ";
+      fen += word;
+      wordCount++;
+    }
+    if (wordCount == 4)
+      fens.push_back(fen);
+  }
+
+  // all fens in one pipelined batch
+  auto t_start = std::chrono::high_resolution_clock::now();
+  std::vector<std::vector<std::pair<std::string, int>>> results;
+  try {
+    results = cdbclient_get(handle, fens);
+  } catch (const CDBClientError &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    cdbclient_close(handle);
+    return 1;
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+
+  size_t known_fens = 0, scored_moves = 0;
+  for (auto &result : results)
+    if (result.back().second > -2) {
+      known_fens++;
+      scored_moves += result.size() - 1;
+    }
+
+  double elapsed_time_sec =
+      std::chrono::duration<double>(t_end - t_start).count();
+  std::cout << "known fens:   " << known_fens << std::endl;
+  std::cout << "unknown fens: " << fens.size() - known_fens << std::endl;
+  std::cout << "scored moves: " << scored_moves << std::endl;
+  std::cout << "Required probing time: " << elapsed_time_sec << " sec."
+            << std::endl;
+  std::cout << "Required time per fen: "
+            << elapsed_time_sec * 1e6 / std::max<size_t>(fens.size(), 1)
+            << " microsec." << std::endl;
+
+  cdbclient_close(handle);
+  return 0;
+}
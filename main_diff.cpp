@@ -0,0 +1,93 @@
+#include "cdbdirect.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+
+  // compare an older dump with the one at CHESSDB_PATH
+  std::string old_path;
+  bool compare_min_ply = true;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--moves-only")
+      compare_min_ply = false;
+    else
+      old_path = argv[i];
+  }
+
+  if (old_path.empty()) {
+    std::cerr << "Usage: " << argv[0] << " <path of older dump> [--moves-only]"
+              << std::endl;
+    return 1;
+  }
+
+  std::uintptr_t handle_old = cdbdirect_initialize(old_path);
+  std::uintptr_t handle_new = cdbdirect_initialize(CHESSDB_PATH);
+  std::cout << "Comparing " << old_path << " (" << cdbdirect_size(handle_old)
+            << " positions) with " << CHESSDB_PATH << " ("
+            << cdbdirect_size(handle_new) << " positions)." << std::endl;
+
+  std::string ofilename = "cdbdirect_diff.epd";
+  std::ofstream ofile(ofilename);
+  if (!ofile.is_open()) {
+    std::cerr << "Error: Unable to open file" << ofilename << "." << std::endl;
+    return 1;
+  }
+
+  std::atomic<size_t> count_added(0), count_removed(0), count_changed(0);
+  std::mutex ofile_mutex;
+  auto start = std::chrono::steady_clock::now();
+
+  auto report = [&](CDBDiff diff, const std::string &fen,
+                    const std::vector<std::pair<std::string, int>> &old_scored,
+                    const std::vector<std::pair<std::string, int>>
+                        &new_scored) {
+    const char *kind = "changed";
+    if (diff == CDBDiff::ADDED) {
+      kind = "added";
+      count_added++;
+    } else if (diff == CDBDiff::REMOVED) {
+      kind = "removed";
+      count_removed++;
+    } else
+      count_changed++;
+
+    // best score and min_ply of both dumps, if known
+    auto summary = [](const std::vector<std::pair<std::string, int>> &scored) {
+      if (scored.back().second == -2)
+        return std::string("-");
+      std::string best = "none";
+      if (scored.size() > 1)
+        best = scored.front().first + " " +
+               std::to_string(scored.front().second);
+      return best + ", ply: " + std::to_string(scored.back().second);
+    };
+
+    const std::lock_guard<std::mutex> lock(ofile_mutex);
+    ofile << fen << " ; " << kind << " ; old: " << summary(old_scored)
+          << " ; new: " << summary(new_scored) << "\n";
+    return true;
+  };
+
+  const size_t num_threads = std::thread::hardware_concurrency();
+  cdbdirect_diff(handle_old, handle_new, num_threads, compare_min_ply, report);
+  ofile.close();
+
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Added:   " << count_added << std::endl;
+  std::cout << "Removed: " << count_removed << std::endl;
+  std::cout << "Changed: " << count_changed << std::endl;
+  std::cout << "Time (s): "
+            << std::chrono::duration<double>(end - start).count()
+            << std::endl;
+  std::cout << "Differences written to " << ofilename << "." << std::endl;
+
+  cdbdirect_finalize(handle_old);
+  cdbdirect_finalize(handle_new);
+  return 0;
+}
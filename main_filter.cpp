@@ -0,0 +1,66 @@
+#include "cdbdirect.h"
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+
+  std::uint64_t db_size = cdbdirect_size(handle);
+  std::cout << "DB count: " << db_size << std::endl;
+
+  // by default the filter contains all keys, optionally only those of
+  // positions with a known distance to startpos of at most max_ply, which is
+  // not written next to the dump, as it would hide all other positions
+  int max_ply = -1;
+  std::string filename;
+  if (argc > 1)
+    max_ply = std::stoi(argv[1]);
+  if (argc > 2)
+    filename = argv[2];
+  if (max_ply >= 0 && filename.empty()) {
+    std::cerr << "Usage: " << argv[0] << " [max_ply filename]" << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+
+  auto select = [max_ply](const std::string &fen,
+                          const std::vector<std::pair<std::string, int>>
+                              &scored) {
+    int ply = scored.back().second;
+    return ply >= 0 && ply <= max_ply;
+  };
+
+  if (max_ply >= 0)
+    std::cout << "Building filter for positions with min ply <= " << max_ply
+              << " ..." << std::endl;
+  else
+    std::cout << "Building filter for all positions ..." << std::endl;
+
+  auto start = std::chrono::steady_clock::now();
+  const size_t num_threads = std::thread::hardware_concurrency();
+  bool ok = max_ply >= 0 ? cdbdirect_build_filter(handle, num_threads,
+                                                  filename, select)
+                         : cdbdirect_build_filter(handle, num_threads,
+                                                  filename);
+  auto end = std::chrono::steady_clock::now();
+
+  if (!ok) {
+    std::cerr << "Error: building the filter failed." << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+
+  std::cout << "Filter written to "
+            << (filename.empty() ? std::string(CHESSDB_PATH) + ".filter"
+                                 : filename)
+            << std::endl;
+  std::cout << "Time (s): "
+            << std::chrono::duration<double>(end - start).count()
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cdbdirect.h"
+#include "fen2cdb.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// the latencies of probes in ns, with 16 linear buckets per power of two, such
+// that percentiles are exact to about 6%
+struct LatencyHistogram {
+  static const size_t sub_buckets = 16;
+  static const size_t num_buckets = 61 * sub_buckets;
+  std::array<std::uint64_t, num_buckets> counts = {};
+
+  static size_t bucket(std::uint64_t ns) {
+    if (ns < sub_buckets)
+      return ns;
+    int e = 63 - __builtin_clzll(ns);
+    return (e - 3) * sub_buckets + ((ns >> (e - 4)) & (sub_buckets - 1));
+  }
+
+  // the middle of a bucket
+  static double value(size_t b) {
+    if (b < sub_buckets)
+      return b;
+    int e = b / sub_buckets + 3;
+    std::uint64_t width = std::uint64_t(1) << (e - 4);
+    return (sub_buckets + b % sub_buckets) * width + width / 2.0;
+  }
+
+  void add(const LatencyHistogram &other) {
+    for (size_t b = 0; b < num_buckets; b++)
+      counts[b] += other.counts[b];
+  }
+
+  // the latency in microseconds below which the fraction q of the probes is
+  double percentile(double q) const {
+    std::uint64_t total = 0;
+    for (auto count : counts)
+      total += count;
+    if (!total)
+      return 0;
+    std::uint64_t rank = std::max<std::uint64_t>(1, q * total + 0.5), seen = 0;
+    for (size_t b = 0; b < num_buckets; b++)
+      if ((seen += counts[b]) >= rank)
+        return value(b) / 1000;
+    return value(num_buckets - 1) / 1000;
+  }
+};
+
+// the probes of one worker since the last report, collected by the reporter
+struct WorkerStats {
+  std::array<std::atomic<std::uint64_t>, LatencyHistogram::num_buckets>
+      latencies = {};
+  std::atomic<std::uint64_t> probes{0};
+  std::atomic<std::uint64_t> hits{0};
+};
+
+// a report over an interval or the whole run
+struct Report {
+  LatencyHistogram latencies;
+  std::uint64_t probes = 0, hits = 0;
+
+  void print(double seconds) const {
+    std::cout << std::setw(12) << probes / std::max(seconds, 1e-9)
+              << std::setw(8) << (probes ? hits * 100.0 / probes : 0);
+    for (double q : {0.5, 0.9, 0.99, 0.999})
+      std::cout << std::setw(10) << latencies.percentile(q);
+    std::cout << std::endl;
+  }
+};
+
+// the fens of an EPD file, the first 4 fields of each line
+bool load_epd(const std::string &filename, std::vector<std::string> &fens) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cerr << "Error: Unable to open the trace " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream iss(line);
+    std::string word, fen;
+    int wordCount = 0;
+    while (wordCount < 4 && iss >> word) {
+      if (wordCount > 0)
+        fen += " ";
+      fen += word;
+      wordCount++;
+    }
+    if (wordCount == 4)
+      fens.push_back(fen);
+  }
+  return true;
+}
+
+// the fens of a file of DB keys ('h' and the binary hexfen), each preceded by
+// its length in one byte
+bool load_keys(const std::string &filename, std::vector<std::string> &fens) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Error: Unable to open the trace " << filename << std::endl;
+    return false;
+  }
+  char length;
+  std::string key;
+  while (file.get(length)) {
+    key.resize(static_cast<unsigned char>(length));
+    if (!file.read(&key[0], key.size()) || key.size() < 2 || key[0] != 'h') {
+      std::cerr << "Error: Invalid key " << fens.size() << " in " << filename
+                << std::endl;
+      return false;
+    }
+    fens.push_back(cbhexfen2fen(bin2hex(key.substr(1))));
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+
+  // <trace.epd> or --keys <file> the trace of the probes to replay
+  // --concurrency <N> the number of probes in flight (default: one per thread)
+  // --qps <R> open loop, probes start at R per second whether or not earlier
+  //           ones are done, and queueing counts as latency (default: closed
+  //           loop, each worker probes again when its last probe is done)
+  // --duration <s> repeat the trace for s seconds (default: replay it once)
+  // --interval <s> the seconds between reports
+  // --best probe with cdbdirect_get_best for the best move only
+  std::string filename = "caissa_sorted_100000.epd";
+  bool binary = false, best = false;
+  size_t concurrency = std::thread::hardware_concurrency();
+  double qps = 0, duration = 0, interval = 1;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--keys" && i + 1 < argc) {
+      filename = argv[++i];
+      binary = true;
+    } else if (arg == "--concurrency" && i + 1 < argc)
+      concurrency = std::max<size_t>(1, std::stoull(argv[++i]));
+    else if (arg == "--qps" && i + 1 < argc)
+      qps = std::stod(argv[++i]);
+    else if (arg == "--duration" && i + 1 < argc)
+      duration = std::stod(argv[++i]);
+    else if (arg == "--interval" && i + 1 < argc)
+      interval = std::max(0.001, std::stod(argv[++i]));
+    else if (arg == "--best")
+      best = true;
+    else
+      filename = arg;
+  }
+
+  std::cout << "Loading: " << filename << std::endl;
+  std::vector<std::string> trace;
+  if (!(binary ? load_keys(filename, trace) : load_epd(filename, trace)))
+    return 1;
+  if (trace.empty()) {
+    std::cerr << "Error: The trace is empty." << std::endl;
+    return 1;
+  }
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+  std::cout << "Opened DB with " << cdbdirect_size(handle)
+            << " stored positions." << std::endl;
+  std::cout << "Replaying " << trace.size() << " probes ";
+  if (duration > 0)
+    std::cout << "for " << duration << " s ";
+  else
+    std::cout << "once ";
+  std::cout << "with " << concurrency << " workers, ";
+  if (qps > 0)
+    std::cout << "open loop at " << qps << " qps." << std::endl;
+  else
+    std::cout << "closed loop." << std::endl;
+
+  std::vector<std::unique_ptr<WorkerStats>> stats;
+  for (size_t w = 0; w < concurrency; w++)
+    stats.emplace_back(new WorkerStats);
+  std::atomic<std::uint64_t> next(0);
+  std::atomic<bool> stop(false);
+  const std::uint64_t max_probes =
+      duration > 0 ? UINT64_MAX : std::uint64_t(trace.size());
+  const Clock::time_point start = Clock::now();
+
+  auto worker = [&](WorkerStats &own) {
+    for (std::uint64_t i; !stop && (i = next++) < max_probes;) {
+      const std::string &fen = trace[i % trace.size()];
+
+      // in the open loop, the latency counts from the scheduled start
+      Clock::time_point t0 = Clock::now();
+      if (qps > 0) {
+        t0 = start + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double>(i / qps));
+        std::this_thread::sleep_until(t0);
+        if (stop)
+          break;
+      }
+
+      bool hit = best ? cdbdirect_get_best(handle, fen, 1).min_ply > -2
+                      : cdbdirect_get(handle, fen).back().second > -2;
+
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - t0)
+                    .count();
+      own.latencies[LatencyHistogram::bucket(std::max<std::int64_t>(ns, 0))]
+          .fetch_add(1, std::memory_order_relaxed);
+      own.probes.fetch_add(1, std::memory_order_relaxed);
+      if (hit)
+        own.hits.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (auto &own : stats)
+    workers.emplace_back(worker, std::ref(*own));
+
+  // collect the probes of all workers since the last report
+  auto collect = [&stats](Report &report) {
+    for (auto &own : stats) {
+      for (size_t b = 0; b < LatencyHistogram::num_buckets; b++)
+        report.latencies.counts[b] += own->latencies[b].exchange(0);
+      report.probes += own->probes.exchange(0);
+      report.hits += own->hits.exchange(0);
+    }
+  };
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(8) << "time(s)" << std::setw(12) << "probes/s"
+            << std::setw(8) << "hit%" << std::setw(10) << "p50(us)"
+            << std::setw(10) << "p90(us)" << std::setw(10) << "p99(us)"
+            << std::setw(10) << "p99.9(us)" << std::endl;
+
+  // report per interval until the trace or the duration is done
+  Report total;
+  Clock::time_point last = start;
+  auto interval_length = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(interval));
+  auto duration_length = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(duration));
+  for (bool done = false; !done;) {
+    Clock::time_point until = last + interval_length;
+    while (Clock::now() < until && next < max_probes)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (duration > 0 && Clock::now() - start >= duration_length)
+      stop = true;
+    done = stop || next >= max_probes;
+    if (done)
+      for (auto &t : workers)
+        t.join();
+
+    Report report;
+    collect(report);
+    Clock::time_point now = Clock::now();
+    std::cout << std::setw(8)
+              << std::chrono::duration<double>(now - start).count();
+    report.print(std::chrono::duration<double>(now - last).count());
+    total.latencies.add(report.latencies);
+    total.probes += report.probes;
+    total.hits += report.hits;
+    last = now;
+  }
+
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << std::setw(8) << "total";
+  total.print(elapsed);
+  std::cout << "Probes: " << total.probes << " in " << elapsed << " s"
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
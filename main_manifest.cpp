@@ -0,0 +1,54 @@
+#include "cdbdirect.h"
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+
+  // optionally the number of keys per range, and the output file
+  size_t keys_per_range = 1000000;
+  if (argc > 1)
+    keys_per_range = std::stoull(argv[1]);
+  std::string filename = argc > 2 ? argv[2] : "";
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+  std::cout << "Estimated DB count: " << cdbdirect_size(handle) << std::endl;
+  std::cout << "Building manifest with " << keys_per_range
+            << " keys per range ..." << std::endl;
+
+  auto start = std::chrono::steady_clock::now();
+  const size_t num_threads = std::thread::hardware_concurrency();
+  if (!cdbdirect_build_manifest(handle, num_threads, filename,
+                                keys_per_range)) {
+    std::cerr << "Error: building the manifest failed." << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  std::string manifest_file =
+      filename.empty() ? std::string(CHESSDB_PATH) + ".manifest" : filename;
+  if (!cdbdirect_load_manifest(handle, manifest_file)) {
+    std::cerr << "Error: Unable to load " << manifest_file << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+
+  std::uint64_t bytes = 0;
+  auto ranges = cdbdirect_ranges(handle);
+  for (auto &range : ranges)
+    bytes += range.bytes;
+
+  std::cout << "Manifest written to " << manifest_file << std::endl;
+  std::cout << "  Ranges:  " << ranges.size() << std::endl;
+  std::cout << "  Entries: " << cdbdirect_size(handle) << std::endl;
+  std::cout << "  Bytes:   " << bytes << std::endl;
+  std::cout << "Time (s): "
+            << std::chrono::duration<double>(end - start).count()
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
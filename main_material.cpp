@@ -0,0 +1,90 @@
+#include "cdbdirect.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+
+  // either build the index, optionally with the maximal number of pieces and
+  // the keys per block, or write the entries of a material signature
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " --build [max_pieces] [keys_per_block]" << std::endl
+              << "       " << argv[0] << " <signature, e.g. KRPvKR>"
+              << std::endl;
+    return 1;
+  }
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+  const size_t num_threads = std::thread::hardware_concurrency();
+  auto start = std::chrono::steady_clock::now();
+
+  if (std::string(argv[1]) == "--build") {
+    size_t max_pieces = argc > 2 ? std::stoull(argv[2]) : 7;
+    size_t keys_per_block = argc > 3 ? std::stoull(argv[3]) : 16384;
+    std::cout << "Building material index of positions with at most "
+              << max_pieces << " pieces, in blocks of " << keys_per_block
+              << " keys ..." << std::endl;
+    if (!cdbdirect_build_material(handle, num_threads, "", max_pieces,
+                                  keys_per_block)) {
+      std::cerr << "Error: building the material index failed." << std::endl;
+      cdbdirect_finalize(handle);
+      return 1;
+    }
+    std::cout << "Material index written to " << CHESSDB_PATH << ".material"
+              << std::endl;
+  } else {
+    std::string signature = argv[1];
+    std::string ofilename = "cdbdirect_" + signature + ".epd";
+    std::ofstream ofile(ofilename);
+    if (!ofile.is_open()) {
+      std::cerr << "Error: Unable to open file " << ofilename << "."
+                << std::endl;
+      cdbdirect_finalize(handle);
+      return 1;
+    }
+
+    std::mutex ofile_mutex;
+    std::atomic<size_t> count(0);
+    bool ok = cdbdirect_apply_material(
+        handle, num_threads, signature,
+        [&](const std::string &fen,
+            const std::vector<std::pair<std::string, int>> &scored) {
+          count++;
+          const std::lock_guard<std::mutex> lock(ofile_mutex);
+          ofile << fen << " ; cdb eval: ";
+          int s = scored.size() > 1 ? scored.front().second : 0;
+          if (scored.size() == 1)
+            ofile << "-";
+          else if (std::abs(s) > 25000)
+            ofile << (s > 0 ? "M" : "-M") << 30000 - std::abs(s);
+          else
+            ofile << s;
+          if (scored.back().second >= 0)
+            ofile << ", ply: " << scored.back().second;
+          ofile << ";\n";
+          return true;
+        });
+    ofile.close();
+    if (!ok) {
+      cdbdirect_finalize(handle);
+      return 1;
+    }
+    std::cout << count << " positions of " << signature << " written to "
+              << ofilename << std::endl;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Time (s): "
+            << std::chrono::duration<double>(end - start).count()
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include "cdbresults.h"
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[]) {
+
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <merged.results> <shard.results> [<shard.results> ...]"
+              << std::endl;
+    return 1;
+  }
+
+  // the results of cdbdirect_apply --shard, or already merged results
+  ScanResults merged;
+  for (int i = 2; i < argc; i++) {
+    ScanResults results;
+    if (!read_results(argv[i], results)) {
+      std::cerr << "Error: Unable to read " << argv[i] << std::endl;
+      return 1;
+    }
+    if (results.counters.size() != 4 || results.histograms.size() != 2 ||
+        results.histograms[0].size() != 65536 ||
+        results.histograms[1].size() != 65536) {
+      std::cerr << "Error: " << argv[i]
+                << " are not results of cdbdirect_apply" << std::endl;
+      return 1;
+    }
+    if (!merge_results(merged, results)) {
+      std::cerr << "Error: Unable to merge " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  if (!write_results(argv[1], merged))
+    return 1;
+
+  std::cout << "Merged " << merged.shards.size() << " of " << merged.num_shards
+            << " shards into " << argv[1] << std::endl;
+  if (merged.shards.size() < merged.num_shards) {
+    std::cout << "Missing shards:";
+    for (std::uint32_t shard = 0, i = 0; shard < merged.num_shards; shard++)
+      if (i < merged.shards.size() && merged.shards[i] == shard)
+        i++;
+      else
+        std::cout << " " << shard;
+    std::cout << std::endl;
+  }
+
+  std::cout << "Final count:          " << merged.counters[0] << std::endl;
+  std::cout << "  Have min ply:       " << merged.counters[1] << "\n";
+  std::cout << "  Have single move:   " << merged.counters[2] << "\n";
+  std::cout << "  Total scored moves: " << merged.counters[3] << "\n";
+
+  std::ofstream file_ply("min_ply_histogram.txt");
+  for (size_t i = 0; i < 65536; ++i)
+    file_ply << i << " " << merged.histograms[0][i] << "\n";
+  file_ply.close();
+
+  std::ofstream file_score("score_histogram.txt");
+  for (size_t i = 0; i < 65536; ++i)
+    file_score << int(i) - 32768 << " " << merged.histograms[1][i] << "\n";
+  file_score.close();
+
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include "cdbdirect.h"
+#include "cdbpolyglot.h"
+#include "fen2cdb.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// the entries of the book collected by each thread of the scan
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<std::vector<PolyglotEntry>>> buffers;
+thread_local std::vector<PolyglotEntry> *buffer = nullptr;
+
+std::vector<PolyglotEntry> &thread_buffer() {
+  if (!buffer) {
+    const std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.emplace_back(new std::vector<PolyglotEntry>);
+    buffer = buffers.back().get();
+  }
+  return *buffer;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+
+  // --random64 <file> the 781 Random64 numbers of the Polyglot format
+  // --max-ply <N> only positions with a known min_ply of at most N
+  // --window <cp> the moves scoring at most cp below the best move
+  // --run-entries <N> the entries per thread sorted and written as one run
+  std::string book, random_file = "polyglot_random64.txt";
+  int max_ply = -1, window = 0;
+  size_t run_entries = 4 * 1024 * 1024;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--random64" && i + 1 < argc)
+      random_file = argv[++i];
+    else if (arg == "--max-ply" && i + 1 < argc)
+      max_ply = std::stoi(argv[++i]);
+    else if (arg == "--window" && i + 1 < argc)
+      window = std::stoi(argv[++i]);
+    else if (arg == "--run-entries" && i + 1 < argc)
+      run_entries = std::max<size_t>(1, std::stoull(argv[++i]));
+    else
+      book = arg;
+  }
+  if (book.empty() || window < 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " <book.bin> [--random64 file] [--max-ply N] [--window cp]"
+                 " [--run-entries N]"
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<std::uint64_t> random;
+  if (!load_polyglot_random(random_file, random))
+    return 1;
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+  const size_t num_threads = std::thread::hardware_concurrency();
+  auto start = std::chrono::steady_clock::now();
+
+  // each entry gives the book moves of the position and of its BW mirror,
+  // which the DB stores as the same entry. The weight of a move falls
+  // linearly from window + 1 for the best move to 1 at the edge of the window
+  PolyglotRuns runs(book);
+  std::atomic<size_t> positions(0);
+  std::atomic<bool> failed(false);
+  std::cout << "Exporting the book " << book << " ..." << std::endl;
+  cdbdirect_apply(
+      handle, num_threads,
+      [&](const std::string &fen,
+          const std::vector<std::pair<std::string, int>> &scored) {
+        int ply = scored.back().second;
+        if (scored.size() == 1 || (max_ply >= 0 && (ply < 0 || ply > max_ply)))
+          return true;
+
+        std::string bwfen = cbgetBWfen(fen);
+        std::uint64_t key, bwkey;
+        if (!polyglot_key(fen, random, key) ||
+            !polyglot_key(bwfen, random, bwkey))
+          return true;
+
+        auto &entries = thread_buffer();
+        int best = scored.front().second;
+        for (size_t i = 0; i + 1 < scored.size(); i++) {
+          int loss = best - scored[i].second;
+          if (loss > window)
+            break;
+          std::uint16_t weight = std::min(window + 1 - loss, 65535);
+          std::uint16_t move, bwmove;
+          if (!polyglot_move(fen, scored[i].first, move) ||
+              !polyglot_move(bwfen, cbgetBWmove(scored[i].first), bwmove))
+            continue;
+          entries.push_back({key, move, weight, 0});
+          entries.push_back({bwkey, bwmove, weight, 0});
+        }
+        positions++;
+
+        if (entries.size() >= run_entries && !runs.write_run(entries)) {
+          failed = true;
+          return false;
+        }
+        return true;
+      });
+
+  // the last runs, sorted in parallel
+  std::vector<std::thread> flushers;
+  for (auto &entries : buffers)
+    if (!entries->empty())
+      flushers.emplace_back([&runs, &entries, &failed]() {
+        if (!runs.write_run(*entries))
+          failed = true;
+      });
+  for (auto &flusher : flushers)
+    flusher.join();
+
+  std::uint64_t num_entries = 0;
+  if (failed || !runs.merge(num_entries)) {
+    std::cerr << "Error: writing the book " << book << " failed." << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  std::cout << num_entries << " book entries of " << positions
+            << " positions (and their mirrors) written to " << book
+            << std::endl;
+  std::cout << "Time (s): "
+            << std::chrono::duration<double>(end - start).count()
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
@@ -0,0 +1,200 @@
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "cdbdirect.h"
+#include "cdbproto.h"
+#include "fen2cdb.h"
+
+// entries of a scan are sent in frames of about this size
+const size_t entries_frame_size = 256 * 1024;
+
+// the clients served at once, each by a thread of its own
+std::atomic<size_t> num_clients(0);
+
+// the requests of a client that arrived while a scan was running, which are
+// answered after the scan, in order
+using PendingFrames = std::deque<std::pair<CDBFrame, std::string>>;
+
+// has the client asked to stop the running scan, or is it gone? Other requests
+// sent meanwhile (pipelined) are kept for later
+bool stop_requested(int fd, PendingFrames &pending) {
+  pollfd pfd = {fd, POLLIN, 0};
+  while (poll(&pfd, 1, 0) > 0) {
+    CDBFrame type;
+    std::string payload;
+    if (!read_frame(fd, type, payload) || type == CDBFrame::STOP)
+      return true;
+    pending.emplace_back(type, std::move(payload));
+  }
+  return false;
+}
+
+bool serve_apply(std::uintptr_t handle, int fd, PayloadReader &reader,
+                 PendingFrames &pending) {
+  std::uint32_t num_threads;
+  if (!reader.get(num_threads) || num_threads == 0)
+    return write_frame(fd, CDBFrame::ERROR, "invalid APPLY request");
+
+  // the scan threads fill a shared frame, and send it when full. A client
+  // that does not read for the send timeout stops the scan.
+  std::mutex frame_mutex;
+  std::string frame;
+  std::uint32_t count = 0;
+  std::atomic<bool> proceed(true);
+
+  auto flush = [&]() {
+    std::memcpy(&frame[0], &count, sizeof(count));
+    if (!write_frame(fd, CDBFrame::ENTRIES, frame) ||
+        stop_requested(fd, pending))
+      proceed = false;
+    frame.clear();
+    count = 0;
+  };
+
+  auto evaluate_entry =
+      [&](const std::string &fen,
+          const std::vector<std::pair<std::string, int>> &scored) {
+        const std::lock_guard<std::mutex> lock(frame_mutex);
+        if (!proceed)
+          return false;
+        if (frame.empty())
+          put(frame, std::uint32_t(0));
+        put_string(frame, fen);
+        put_scored(frame, scored);
+        count++;
+        if (frame.size() >= entries_frame_size)
+          flush();
+        return proceed.load();
+      };
+
+  cdbdirect_apply(handle, num_threads, evaluate_entry);
+
+  if (proceed && count > 0)
+    flush();
+  return write_frame(fd, CDBFrame::DONE, "");
+}
+
+// answer the requests of one client, in order, until it disconnects
+void serve(std::uintptr_t handle, int fd) {
+  CDBFrame type;
+  std::string payload, reply, fen;
+  std::vector<std::pair<std::string, int>> scored;
+  PendingFrames pending;
+
+  // the requests received during a scan come first
+  auto next_request = [&]() {
+    if (pending.empty())
+      return read_frame(fd, type, payload);
+    type = pending.front().first;
+    payload = std::move(pending.front().second);
+    pending.pop_front();
+    return true;
+  };
+
+  bool ok = true;
+  while (ok && next_request()) {
+    PayloadReader reader(payload);
+    reply.clear();
+    if (type == CDBFrame::SIZE) {
+      put(reply, std::uint64_t(cdbdirect_size(handle)));
+      ok = write_frame(fd, CDBFrame::SIZE, reply);
+    } else if (type == CDBFrame::GET) {
+      // the fens come from any client, and are checked before the probe
+      std::uint32_t n = 0;
+      bool valid = true;
+      reader.get(n);
+      for (std::uint32_t i = 0; valid && i < n && reader.get_string(fen); i++)
+        if ((valid = cbfen_valid(fen)))
+          put_scored(reply, cdbdirect_get(handle, fen));
+      if (!valid)
+        ok = write_frame(fd, CDBFrame::ERROR,
+                         "invalid fen " + fen.substr(0, CHESS_FEN_MAX_LENGTH));
+      else
+        ok = reader.ok()
+                 ? write_frame(fd, CDBFrame::GET, reply)
+                 : write_frame(fd, CDBFrame::ERROR, "invalid GET request");
+    } else if (type == CDBFrame::APPLY)
+      ok = serve_apply(handle, fd, reader, pending);
+    else if (type != CDBFrame::STOP) // a late STOP of a finished scan is fine
+      ok = write_frame(fd, CDBFrame::ERROR, "unknown request");
+  }
+
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+
+  // a bound on the open files makes for a fast (re)start, the tables are
+  // loaded when first needed
+  // --max-clients <N> the clients served at once, others are refused
+  // --send-timeout <s> drop a client that does not read its replies for s
+  std::string address = CDB_SERVER_ADDRESS;
+  CDBOpenOptions options;
+  size_t max_clients = 64;
+  double send_timeout = 30;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--max-open-files" && i + 1 < argc) {
+      options.max_open_files = std::stoi(argv[++i]);
+      options.lazy_min_ply = true;
+    } else if (arg == "--max-clients" && i + 1 < argc)
+      max_clients = std::max<size_t>(1, std::stoull(argv[++i]));
+    else if (arg == "--send-timeout" && i + 1 < argc)
+      send_timeout = std::max(0.001, std::stod(argv[++i]));
+    else
+      address = argv[i];
+  }
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH, options);
+
+  int listen_fd = cdb_listen(address);
+  if (listen_fd < 0) {
+    std::cerr << "Error: Unable to listen on " << address << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+
+  double open_time = 0;
+  for (auto &phase : cdbdirect_open_timings(handle))
+    open_time += phase.second;
+  std::cout << "Serving " << CHESSDB_PATH << " (" << cdbdirect_size(handle)
+            << " positions, opened in " << open_time << " s) on " << address
+            << std::endl;
+
+  // one thread per client connection, all sharing the DB and its cache
+  timeval timeout;
+  timeout.tv_sec = static_cast<time_t>(send_timeout);
+  timeout.tv_usec =
+      static_cast<suseconds_t>((send_timeout - timeout.tv_sec) * 1e6);
+  while (true) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (num_clients >= max_clients) {
+      write_frame(fd, CDBFrame::ERROR, "too many clients");
+      close(fd);
+      continue;
+    }
+    num_clients++;
+    std::thread([handle, fd]() {
+      serve(handle, fd);
+      num_clients--;
+    }).detach();
+  }
+
+  close(listen_fd);
+  cdbdirect_finalize(handle);
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include "cdbdirect.h"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <max_ply | file.epd> [snapshot]"
+              << std::endl;
+    std::cerr << "  Snapshot all positions with a known distance to startpos "
+                 "of at most max_ply, or the positions given in file.epd."
+              << std::endl;
+    return 1;
+  }
+
+  std::string selection = argv[1];
+  std::string filename = argc > 2 ? argv[2] : "";
+  bool by_ply = selection.find_first_not_of("0123456789") == std::string::npos;
+
+  // read the fens first, if a file is given
+  std::vector<std::string> fens;
+  if (!by_ply) {
+    std::cout << "Loading: " << selection << std::endl;
+    std::ifstream file(selection);
+    if (!file.is_open()) {
+      std::cerr << "Error: Unable to open file." << std::endl;
+      return 1;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      // Retain just the first 4 fields, no move counters etc
+      std::istringstream iss(line);
+      std::string word, fen;
+      int wordCount = 0;
+      while (iss >> word && wordCount < 4) {
+        if (wordCount > 0)
+          fen += " ";
+        fen += word;
+        wordCount++;
+      }
+      if (wordCount == 4)
+        fens.push_back(fen);
+    }
+  }
+
+  std::uintptr_t handle = cdbdirect_initialize(CHESSDB_PATH);
+
+  auto start = std::chrono::steady_clock::now();
+  bool ok;
+  if (by_ply) {
+    int max_ply = std::stoi(selection);
+    std::cout << "Building snapshot for positions with min ply <= " << max_ply
+              << " ..." << std::endl;
+    auto select = [max_ply](const std::string &fen,
+                            const std::vector<std::pair<std::string, int>>
+                                &scored) {
+      int ply = scored.back().second;
+      return ply >= 0 && ply <= max_ply;
+    };
+    const size_t num_threads = std::thread::hardware_concurrency();
+    ok = cdbdirect_build_snapshot(handle, num_threads, filename, select);
+  } else {
+    std::cout << "Building snapshot for " << fens.size() << " fens ..."
+              << std::endl;
+    ok = cdbdirect_build_snapshot(handle, fens, filename);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (!ok) {
+    std::cerr << "Error: building the snapshot failed." << std::endl;
+    cdbdirect_finalize(handle);
+    return 1;
+  }
+
+  std::cout << "Snapshot written to "
+            << (filename.empty() ? std::string(CHESSDB_PATH) + ".snapshot"
+                                 : filename)
+            << std::endl;
+  std::cout << "Time (s): "
+            << std::chrono::duration<double>(end - start).count()
+            << std::endl;
+
+  cdbdirect_finalize(handle);
+  return 0;
+}
@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -15,12 +16,27 @@
 
 #include "external/threadpool.hpp"
 
+// results gathered by the threads of one NUMA node
+struct NodeResults {
+  std::mutex known_fens_vector_mutex;
+  std::vector<std::pair<std::string, std::pair<int, int>>> known_fens_vector;
+  std::atomic<size_t> known_fens = 0;
+  std::atomic<size_t> unknown_fens = 0;
+  std::atomic<size_t> scored_moves = 0;
+};
+
 int main(int argc, char *argv[]) {
 
   std::string filename = "caissa_sorted_100000.epd";
 
-  if (argc > 1)
-    filename = argv[1];
+  // --numa pins the probing threads per NUMA node, with per-node results
+  bool numa = false;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--numa")
+      numa = true;
+    else
+      filename = argv[i];
+  }
 
   // open file with fen/epd
   std::cout << "Loading: " << filename << std::endl;
@@ -60,20 +76,24 @@ int main(int argc, char *argv[]) {
   }
   file.close();
 
-  // keep a list of known fens to store later
-  std::mutex known_fens_vector_mutex;
-  std::vector<std::pair<std::string, std::pair<int, int>>> known_fens_vector;
-  auto add_known = [&known_fens_vector, &known_fens_vector_mutex](
-                       const std::string &fen, int e, int p) {
-    const std::lock_guard<std::mutex> lock(known_fens_vector_mutex);
-    known_fens_vector.push_back(std::pair<std::string, std::pair<int, int>>(
-        fen, std::pair<int, int>(e, p)));
+  // keep a list of known fens to store later, and the counts, per node
+  const size_t num_nodes = numa ? cdbdirect_numa_nodes() : 1;
+  std::vector<std::unique_ptr<NodeResults>> node_results(num_nodes);
+  for (size_t node = 0; node < num_nodes; node++)
+    std::thread([&node_results, node, numa]() {
+      if (numa)
+        cdbdirect_numa_pin(node);
+      node_results[node] = std::make_unique<NodeResults>();
+    }).join();
+
+  auto add_known = [](NodeResults &results, const std::string &fen, int e,
+                      int p) {
+    const std::lock_guard<std::mutex> lock(results.known_fens_vector_mutex);
+    results.known_fens_vector.push_back(
+        std::pair<std::string, std::pair<int, int>>(fen,
+                                                    std::pair<int, int>(e, p)));
   };
 
-  std::atomic<size_t> known_fens = 0;
-  std::atomic<size_t> unknown_fens = 0;
-  std::atomic<size_t> scored_moves = 0;
-
   // Create a thread pool
   ThreadPool pool(num_threads);
 
@@ -82,27 +102,34 @@ int main(int argc, char *argv[]) {
   std::cout << "Opened DB with " << size << " stored positions." << std::endl;
 
   // start probing
-  std::cout << "Probing " << nfen << " fens with " << num_threads << " threads."
-            << std::endl;
+  std::cout << "Probing " << nfen << " fens with " << num_threads << " threads";
+  if (numa)
+    std::cout << " on " << num_nodes << " NUMA nodes";
+  std::cout << "." << std::endl;
   auto t_start = std::chrono::high_resolution_clock::now();
-  for (const auto &chunk : fens_chunked)
-    pool.enqueue([&handle, &known_fens, &unknown_fens, &scored_moves, &chunk,
-                  &add_known]() {
-      for (auto &fen : chunk) {
-
-        std::vector<std::pair<std::string, int>> result =
-            cdbdirect_get(handle, fen);
-
-        size_t n_elements = result.size();
-        int ply = result[n_elements - 1].second;
-
-        if (ply > -2) {
-          known_fens++;
-          add_known(fen, result[0].second, ply);
+  for (size_t c = 0; c < fens_chunked.size(); c++)
+    pool.enqueue([&handle, &fens_chunked, &node_results, &add_known, c,
+                  num_nodes, numa]() {
+      // consecutive chunks are probed on the same node
+      size_t node = c * num_nodes / fens_chunked.size();
+      if (numa)
+        cdbdirect_numa_pin(node);
+      NodeResults &results = *node_results[node];
+
+      for (auto &fen : fens_chunked[c]) {
+
+        // only the best move is needed
+        CDBBest best = cdbdirect_get_best(handle, fen, 1);
+
+        if (best.min_ply > -2) {
+          results.known_fens++;
+          add_known(results, fen,
+                    best.num_moves > 0 ? best.moves[0].score : best.min_ply,
+                    best.min_ply);
         } else
-          unknown_fens++;
+          results.unknown_fens++;
 
-        scored_moves += n_elements - 1;
+        results.scored_moves += best.total_moves;
       }
     });
 
@@ -110,6 +137,13 @@ int main(int argc, char *argv[]) {
   pool.wait();
   auto t_end = std::chrono::high_resolution_clock::now();
 
+  size_t known_fens = 0, unknown_fens = 0, scored_moves = 0;
+  for (auto &results : node_results) {
+    known_fens += results->known_fens;
+    unknown_fens += results->unknown_fens;
+    scored_moves += results->scored_moves;
+  }
+
   std::cout << std::fixed << std::setprecision(2);
   std::cout << "known fens:   " << std::right << std::setw(12) << known_fens
             << "  ( " << std::right << std::setw(5) << known_fens * 100.0 / nfen
@@ -130,10 +164,11 @@ int main(int argc, char *argv[]) {
             << " microsec." << std::endl;
 
   std::unordered_map<std::string, std::pair<int, int>> eval_map;
-  eval_map.reserve(known_fens_vector.size());
-  for (auto &tuple : known_fens_vector) {
-    eval_map[tuple.first] = tuple.second;
-  }
+  eval_map.reserve(known_fens);
+  for (auto &results : node_results)
+    for (auto &tuple : results->known_fens_vector) {
+      eval_map[tuple.first] = tuple.second;
+    }
 
   std::string ofilename = "cdbdirect.epd";
   std::ofstream ofile(ofilename);
@@ -176,6 +211,11 @@ int main(int argc, char *argv[]) {
   ofile.close();
   std::cout << "Known evals written to " << ofilename << "." << std::endl;
 
+  // the time per stage, if built with PROFILE=1
+  for (auto &stage : cdbdirect_profile())
+    std::cout << "  " << stage.stage << ": " << stage.seconds << " s, "
+              << stage.calls << " calls\n";
+
   // Close DB
   std::cout << "Closing DB" << std::endl;
   handle = cdbdirect_finalize(handle);
@@ -11,8 +11,10 @@ os.environ["CXX"] = "g++"
 
 # 2. Extract the library names from your LIBS string
 # (Removing the '-l' prefix)
+# (libcdbdirect.a is linked as an object, as libcdbdirect.so next to it
+# exports only the C interface)
 libraries = [
-    "cdbdirect",
+    "cdbclient",
     "terarkdb",
     "terark-zip-r",
     "boost_fiber",
@@ -46,6 +48,7 @@ ext_modules = [
             os.path.join(terark_root, "output/lib"),
         ],
         # Corresponds to -l flags
+        extra_objects=["libcdbdirect.a"],
         libraries=all_libs,
         # Corresponds to CXXFLAGS
         extra_compile_args=[